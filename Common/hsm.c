@@ -0,0 +1,218 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hsm.h"
+#include "systick.h"
+
+static uint8_t state_parent(const Hsm *hsm, uint8_t state) {
+    return pgm_read_byte(&hsm->states[state].parent);
+}
+
+static uint8_t state_initial(const Hsm *hsm, uint8_t state) {
+    return pgm_read_byte(&hsm->states[state].initial);
+}
+
+// true if ancestor is state itself or one of its parents
+static bool state_contains(const Hsm *hsm, uint8_t ancestor, uint8_t state) {
+    while (state != HSM_NO_STATE) {
+        if (state == ancestor) return true;
+        state = state_parent(hsm, state);
+    }
+    return false;
+}
+
+// Bucket upper bounds grow by 4x: 16 ms, 64 ms, 256 ms, ... 65.5 s
+static uint8_t dwell_bucket(uint32_t ms) {
+    uint8_t bucket = 0;
+    ms >>= 4;
+    while (ms != 0 && bucket < HSM_DWELL_BUCKETS - 1) {
+        ms >>= 2;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void enter_state(Hsm *hsm, uint8_t state) {
+    HsmStateStats *s = &hsm->stats[state];
+    s->entered_ms = SYSTICK_millis();
+    if (s->entries < UINT16_MAX) s->entries++;
+
+    hsm_action_t entry = (hsm_action_t)pgm_read_ptr(&hsm->states[state].entry);
+    if (entry != NULL) entry();
+}
+
+static void exit_state(Hsm *hsm, uint8_t state) {
+    hsm_action_t exit = (hsm_action_t)pgm_read_ptr(&hsm->states[state].exit);
+    if (exit != NULL) exit();
+
+    HsmStateStats *s = &hsm->stats[state];
+    uint32_t dwell = SYSTICK_millis() - s->entered_ms;
+    s->total_ms += dwell;
+    uint16_t *count = &s->dwell[dwell_bucket(dwell)];
+    if (*count < UINT16_MAX) (*count)++;
+}
+
+// Enters target and every state between it and top (exclusive), then the
+// initial children down to a leaf
+static void enter_path(Hsm *hsm, uint8_t top, uint8_t target) {
+    uint8_t path[HSM_MAX_DEPTH];
+    uint8_t depth = 0;
+
+    for (uint8_t s = target; s != top && depth < HSM_MAX_DEPTH; s = state_parent(hsm, s)) {
+        path[depth++] = s;
+    }
+    while (depth > 0) {
+        enter_state(hsm, path[--depth]);
+    }
+
+    uint8_t leaf = target;
+    for (uint8_t child = state_initial(hsm, leaf); child != HSM_NO_STATE;
+         child = state_initial(hsm, leaf)) {
+        leaf = child;
+        enter_state(hsm, leaf);
+    }
+    hsm->current = leaf;
+}
+
+static void transition(Hsm *hsm, uint8_t source, uint8_t target, hsm_action_t action) {
+    // Lowest state that strictly contains both source and target; a
+    // self-transition leaves and re-enters the source
+    uint8_t lca = state_parent(hsm, source);
+    while (lca != HSM_NO_STATE && !state_contains(hsm, lca, target)) {
+        lca = state_parent(hsm, lca);
+    }
+    if (lca == target) {
+        lca = state_parent(hsm, target); // target is an ancestor: re-enter it
+    }
+
+    for (uint8_t s = hsm->current; s != lca; s = state_parent(hsm, s)) {
+        exit_state(hsm, s);
+    }
+
+    hsm->timer_armed = false;
+    if (action != NULL) action();
+
+    enter_path(hsm, lca, target);
+}
+
+static void dispatch(Hsm *hsm, const HsmEvent *event) {
+    hsm->param = event->param;
+
+    for (uint8_t s = hsm->current; s != HSM_NO_STATE; s = state_parent(hsm, s)) {
+        for (uint8_t i = 0; i < hsm->transition_count; i++) {
+            HsmTransition t;
+            memcpy_P(&t, &hsm->transitions[i], sizeof(t));
+
+            if (t.source != s || t.event != event->id) continue;
+            if (t.guard != NULL && !t.guard()) continue;
+
+            if (t.target == HSM_INTERNAL) {
+                if (t.action != NULL) t.action();
+            } else {
+                transition(hsm, s, t.target, t.action);
+            }
+            return;
+        }
+    }
+    // Events without a matching transition are dropped
+}
+
+void HSM_init(Hsm *hsm, const HsmState *states, uint8_t state_count,
+              const HsmTransition *transitions, uint8_t transition_count,
+              HsmStateStats *stats, uint8_t initial) {
+    hsm->states = states;
+    hsm->state_count = state_count;
+    hsm->transitions = transitions;
+    hsm->transition_count = transition_count;
+    hsm->stats = stats;
+    hsm->timer_armed = false;
+    hsm->head = 0;
+    hsm->tail = 0;
+    hsm->param = 0;
+
+    memset(stats, 0, state_count * sizeof(HsmStateStats));
+
+    enter_path(hsm, HSM_NO_STATE, initial);
+}
+
+bool HSM_post(Hsm *hsm, uint8_t event, uint8_t param) {
+    bool posted = false;
+
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t next = (hsm->head + 1) & (HSM_QUEUE_SIZE - 1);
+    if (next != hsm->tail) {
+        hsm->queue[hsm->head].id = event;
+        hsm->queue[hsm->head].param = param;
+        hsm->head = next;
+        posted = true;
+    }
+    SREG = sreg;
+
+    return posted;
+}
+
+static bool timer_due(const Hsm *hsm) {
+    return hsm->timer_armed && (int32_t)(SYSTICK_millis() - hsm->timer_deadline) >= 0;
+}
+
+void HSM_process(Hsm *hsm) {
+    for (;;) {
+        while (hsm->tail != hsm->head) {
+            HsmEvent event = hsm->queue[hsm->tail];
+            hsm->tail = (hsm->tail + 1) & (HSM_QUEUE_SIZE - 1);
+            dispatch(hsm, &event);
+        }
+
+        // The timeout is not queued: a state change while it waits in the
+        // queue would deliver it to a state that did not arm the timer
+        if (!timer_due(hsm)) break;
+
+        HsmEvent timeout = { HSM_EV_TIMEOUT, 0 };
+        hsm->timer_armed = false;
+        dispatch(hsm, &timeout);
+    }
+}
+
+bool HSM_is_idle(Hsm *hsm) {
+    return hsm->tail == hsm->head && !timer_due(hsm);
+}
+
+bool HSM_is_in(const Hsm *hsm, uint8_t state) {
+    return state_contains(hsm, state, hsm->current);
+}
+
+uint8_t HSM_event_param(const Hsm *hsm) {
+    return hsm->param;
+}
+
+void HSM_arm_timer(Hsm *hsm, uint32_t ms) {
+    hsm->timer_deadline = SYSTICK_millis() + ms;
+    hsm->timer_armed = true;
+}
+
+void HSM_report(const Hsm *hsm) {
+    uint32_t now = SYSTICK_millis();
+
+    printf("State            Entries  Total ms  <16ms <64ms <.25s   <1s   <4s  <16s  <66s longer\n");
+    for (uint8_t i = 0; i < hsm->state_count; i++) {
+        const HsmStateStats *s = &hsm->stats[i];
+        char name[17];
+        strncpy_P(name, (const char *)pgm_read_ptr(&hsm->states[i].name), sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+
+        // Count the visit in progress too
+        uint32_t total = s->total_ms;
+        if (HSM_is_in(hsm, i)) total += now - s->entered_ms;
+
+        printf("%-16s %7u %9lu", name, s->entries, total);
+        for (uint8_t b = 0; b < HSM_DWELL_BUCKETS; b++) {
+            printf(" %5u", s->dwell[b]);
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,167 @@
+#ifndef HSM_H
+#define HSM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Hierarchical state machine engine
+ *
+ * A machine is described by two constant tables kept in flash: the states,
+ * each with an optional parent, initial child and entry/exit action, and
+ * the transitions, each with a source state, event, optional guard, optional
+ * action and target state. Events are posted to a small queue (also from
+ * interrupts) and dispatched by HSM_process() from the main loop.
+ *
+ * An event is first matched against the transitions of the active leaf
+ * state, then of its parent and so on; the first row, in table order, whose
+ * guard passes is taken. Transitions are external: every state from the
+ * active leaf up to, but not including, the lowest common ancestor of the
+ * source and target is exited, then the target is entered and the initial
+ * children are entered down to a leaf. A target of HSM_INTERNAL runs the
+ * action without leaving the state.
+ *
+ * Each machine has one timer that delivers HSM_EV_TIMEOUT. It is cancelled on
+ * every state change, so a state arms it from its entry action.
+ *
+ * For every state the engine counts the entries and keeps a histogram of
+ * the time spent in the state per visit.
+ *
+ * Requires SYSTICK_init().
+ */
+
+#define HSM_NO_STATE        0xFF  // no parent / no initial child
+#define HSM_INTERNAL        0xFE  // transition target: run the action, stay in the state
+
+#define HSM_EV_TIMEOUT      0     // posted when the state timer expires
+#define HSM_EV_USER         1     // first application event id
+
+#define HSM_QUEUE_SIZE      8     // must be a power of 2
+#define HSM_MAX_DEPTH       4     // maximum nesting of states
+#define HSM_DWELL_BUCKETS   8     // <16 ms, <64 ms, ... <65.5 s, longer
+
+// Action and guard type definitions, called from HSM_process()
+typedef void (*hsm_action_t)(void);
+typedef bool (*hsm_guard_t)(void);
+
+// State table row, stored in PROGMEM
+typedef struct {
+    uint8_t parent;         // parent state or HSM_NO_STATE
+    uint8_t initial;        // initial child or HSM_NO_STATE for a leaf
+    hsm_action_t entry;     // may be NULL
+    hsm_action_t exit;      // may be NULL
+    const char *name;       // PROGMEM string, used by HSM_report()
+} HsmState;
+
+// Transition table row, stored in PROGMEM
+typedef struct {
+    uint8_t source;
+    uint8_t event;
+    uint8_t target;         // state or HSM_INTERNAL
+    hsm_guard_t guard;      // may be NULL
+    hsm_action_t action;    // may be NULL, runs between exit and entry
+} HsmTransition;
+
+// Per-state metrics, one per state in RAM
+typedef struct {
+    uint32_t entered_ms;                // time of the last entry
+    uint32_t total_ms;                  // time spent in the state
+    uint16_t entries;                   // number of transitions into the state
+    uint16_t dwell[HSM_DWELL_BUCKETS];  // visits per dwell time bucket
+} HsmStateStats;
+
+typedef struct {
+    uint8_t id;
+    uint8_t param;
+} HsmEvent;
+
+typedef struct {
+    const HsmState *states;             // PROGMEM
+    const HsmTransition *transitions;   // PROGMEM
+    HsmStateStats *stats;               // RAM, state_count entries
+    uint8_t state_count;
+    uint8_t transition_count;
+    uint8_t current;                    // active leaf state
+    uint8_t param;                      // parameter of the event being dispatched
+
+    bool timer_armed;
+    uint32_t timer_deadline;
+
+    HsmEvent queue[HSM_QUEUE_SIZE];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+} Hsm;
+
+/**
+ * @brief Initialize a machine and enter its initial state
+ * @param hsm Machine
+ * @param states State table in PROGMEM
+ * @param state_count Number of states
+ * @param transitions Transition table in PROGMEM
+ * @param transition_count Number of transitions
+ * @param stats Metrics storage, one entry per state
+ * @param initial Initial state; its initial children are entered too
+ */
+void HSM_init(Hsm *hsm, const HsmState *states, uint8_t state_count,
+              const HsmTransition *transitions, uint8_t transition_count,
+              HsmStateStats *stats, uint8_t initial);
+
+/**
+ * @brief Queue an event
+ * @param hsm Machine
+ * @param event Event id (HSM_EV_USER or above)
+ * @param param Event parameter, see HSM_event_param()
+ * @return false if the queue is full and the event was dropped
+ *
+ * Safe to call from interrupts.
+ */
+bool HSM_post(Hsm *hsm, uint8_t event, uint8_t param);
+
+/**
+ * @brief Dispatch all queued events and an expired timer
+ * @param hsm Machine
+ *
+ * Call from the main loop. Actions may post further events; they are
+ * dispatched before this function returns.
+ */
+void HSM_process(Hsm *hsm);
+
+/**
+ * @brief Check whether the queue is empty and no timer is due
+ * @param hsm Machine
+ * @return true if HSM_process() has nothing to do
+ */
+bool HSM_is_idle(Hsm *hsm);
+
+/**
+ * @brief Check whether a state is active
+ * @param hsm Machine
+ * @param state State, either the active leaf or one of its ancestors
+ */
+bool HSM_is_in(const Hsm *hsm, uint8_t state);
+
+/**
+ * @brief Get the parameter of the event being dispatched
+ * @param hsm Machine
+ *
+ * For use in guards and actions.
+ */
+uint8_t HSM_event_param(const Hsm *hsm);
+
+/**
+ * @brief Deliver HSM_EV_TIMEOUT after a delay
+ * @param hsm Machine
+ * @param ms Delay in milliseconds
+ *
+ * Re-arming replaces the previous deadline. The timer is cancelled when
+ * the machine changes state.
+ */
+void HSM_arm_timer(Hsm *hsm, uint32_t ms);
+
+/**
+ * @brief Print the entry count, total time and dwell histogram of every state
+ * @param hsm Machine
+ */
+void HSM_report(const Hsm *hsm);
+
+#endif
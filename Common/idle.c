@@ -0,0 +1,134 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/power.h>
+#include <avr/wdt.h>
+#include <stdio.h>
+
+#include "idle.h"
+#include "systick.h"
+#include "usart.h"
+
+// Time spent in power-save, where the system tick stands still
+static volatile uint8_t watchdog_periods = 0;   // counted by the watchdog interrupt
+static uint32_t deep_total_ms = 0;
+
+// Statistics window, reset by IDLE_report()
+static uint32_t window_start_ms = 0;
+static uint32_t asleep_us = 0;
+static uint32_t deep_ms = 0;
+static uint16_t deep_sleeps = 0;
+
+// The watchdog oscillator keeps running in power-save. In interrupt mode,
+// without a reset, it wakes the CPU once per period. Call with interrupts
+// disabled, the change sequence is timed.
+static void watchdog_start(void) {
+    wdt_reset();
+    MCUSR &= ~(1 << WDRF);
+    WDTCSR = (1 << WDCE) | (1 << WDE);
+    WDTCSR = (1 << WDIE);     // 16 ms, no reset
+}
+
+static void watchdog_stop(void) {
+    wdt_reset();
+    WDTCSR = (1 << WDCE) | (1 << WDE);
+    WDTCSR = 0;
+}
+
+void IDLE_init(void) {
+    // Analog parts are not used on either board
+    ADCSRA &= ~(1 << ADEN);   // ADC must be disabled before it is powered down
+    ACSR |= (1 << ACD);       // analog comparator off
+    power_adc_disable();
+    power_spi_disable();
+
+#if defined(__AVR_ATmega2560__)
+    // MEGA: Timer0 (system tick), Timer2, TWI and USART0 stay on
+    power_timer1_disable();
+    power_timer3_disable();
+    power_timer4_disable();
+    power_timer5_disable();
+    power_usart1_disable();
+    power_usart2_disable();
+    power_usart3_disable();
+#endif
+
+    window_start_ms = IDLE_millis();
+    asleep_us = 0;
+    deep_ms = 0;
+    deep_sleeps = 0;
+}
+
+void IDLE_sleep(bool deep) {
+    // Power-save stops the USART clock: finish the debug output first
+    if (deep && !USART_transmit_complete()) {
+        deep = false;
+    }
+
+    set_sleep_mode(deep ? SLEEP_MODE_PWR_SAVE : SLEEP_MODE_IDLE);
+
+    uint32_t start = SYSTICK_micros();
+
+    // sei() takes effect after the next instruction, so no interrupt can
+    // slip in between enabling interrupts and going to sleep
+    cli();
+    if (deep) {
+        watchdog_start();
+    }
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+
+    if (deep) {
+        // Only whole watchdog periods are seen, the rest of the sleep is lost
+        cli();
+        watchdog_stop();
+        uint16_t ms = watchdog_periods * IDLE_WATCHDOG_MS;
+        watchdog_periods = 0;
+        sei();
+
+        deep_total_ms += ms;
+        deep_ms += ms;
+        deep_sleeps++;
+    } else {
+        asleep_us += SYSTICK_micros() - start;
+    }
+}
+
+uint32_t IDLE_millis(void) {
+    return SYSTICK_millis() + deep_total_ms;
+}
+
+void IDLE_delay_ms(uint32_t ms) {
+    uint32_t start = SYSTICK_millis();
+    while (SYSTICK_millis() - start < ms) {
+        IDLE_sleep(false);
+    }
+}
+
+uint8_t IDLE_sleep_ratio(void) {
+    uint32_t window = IDLE_millis() - window_start_ms;
+    if (window == 0) return 0;
+
+    uint32_t asleep = asleep_us / 1000 + deep_ms;
+    if (asleep > window) asleep = window; // the watchdog runs a little fast or slow
+
+    return (uint8_t)((asleep * 100) / window);
+}
+
+void IDLE_report(void) {
+    uint32_t window_ms = IDLE_millis() - window_start_ms;
+
+    printf("Sleep ratio: %u%% of %lu ms, power-save: %lu ms in %u entries\n",
+           IDLE_sleep_ratio(), window_ms, deep_ms, deep_sleeps);
+
+    window_start_ms = IDLE_millis();
+    asleep_us = 0;
+    deep_ms = 0;
+    deep_sleeps = 0;
+}
+
+ISR(WDT_vect) {
+    watchdog_periods++;
+}
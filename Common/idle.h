@@ -0,0 +1,76 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Idle manager
+ *
+ * Puts the CPU to sleep when the caller has no work pending and keeps
+ * statistics on how much of the time is spent asleep.
+ *
+ * SLEEP_MODE_IDLE stops only the CPU clock: the system tick, TWI, USART,
+ * external and pin-change interrupts all keep running and wake the CPU.
+ * SLEEP_MODE_PWR_SAVE also stops the synchronous timers, so it may only be
+ * used when nothing depends on Timer0/1/2; the CPU then wakes on a TWI
+ * address match, INTx or pin-change interrupt. The system tick stands still
+ * in power-save, so the watchdog is run in interrupt mode meanwhile: it
+ * wakes the CPU every IDLE_WATCHDOG_MS and the periods are added to the
+ * sleep statistics and to IDLE_millis(). The part of a power-save sleep
+ * after the last full period is not counted.
+ *
+ * Requires SYSTICK_init().
+ */
+
+#define IDLE_WATCHDOG_MS 16     // watchdog period in power-save, nominal
+
+/**
+ * @brief Power down peripherals that neither board uses
+ *
+ * Disables the ADC, analog comparator and SPI, and on the ATmega2560 the
+ * unused USART1-3 and Timer1/3/4/5 through the power reduction registers.
+ */
+void IDLE_init(void);
+
+/**
+ * @brief Sleep until the next interrupt
+ * @param deep true to use power-save mode (no timers needed),
+ *             false to use idle mode
+ *
+ * Call only when no work is pending. Returns after any enabled interrupt
+ * has been serviced, with interrupts enabled. May be called with interrupts
+ * disabled: an interrupt that became pending after the caller's last check
+ * for work then wakes the CPU right away.
+ */
+void IDLE_sleep(bool deep);
+
+/**
+ * @brief Wait for a number of milliseconds, sleeping between ticks
+ * @param ms Time to wait
+ *
+ * Drop-in replacement for _delay_ms() that lets the CPU sleep.
+ */
+void IDLE_delay_ms(uint32_t ms);
+
+/**
+ * @brief Get the time since start-up, including the time in power-save
+ * @return Milliseconds; the power-save part in whole watchdog periods
+ *
+ * SYSTICK_millis() stops in power-save, use this for wall-clock intervals
+ * on a board that uses it.
+ */
+uint32_t IDLE_millis(void);
+
+/**
+ * @brief Get the fraction of time spent asleep, in idle mode or power-save
+ * @return Percentage (0-100) since the last IDLE_report()
+ */
+uint8_t IDLE_sleep_ratio(void);
+
+/**
+ * @brief Print the sleep statistics to the debug console and start a new window
+ */
+void IDLE_report(void);
+
+#endif
@@ -27,10 +27,18 @@ bool is_valid_message(uint32_t message) {
     if (CHECK_COLLISION(control_bits, LED_MOVING_ON, LED_MOVING_OFF) ||
         CHECK_COLLISION(control_bits, LED_MOVING_BLINK, LED_MOVING_ON) ||
         CHECK_COLLISION(control_bits, LED_MOVING_BLINK, LED_MOVING_OFF) ||
-        CHECK_COLLISION(control_bits, LED_DOOR_OPEN, LED_DOOR_CLOSE)) {
+        CHECK_COLLISION(control_bits, LED_DOOR_OPEN, LED_DOOR_CLOSE) ||
+        CHECK_COLLISION(control_bits, EMERGENCY_STOP, LED_MOVING_ON) ||
+        CHECK_COLLISION(control_bits, EMERGENCY_STOP, SPEAKER_PLAY) ||
+        CHECK_COLLISION(control_bits, SPEAKER_EXT_ID, LED_DIM)) {
         return false; // Collision detected
     }
 
+    // An upload frame uses the data bits for itself
+    if ((control_bits & SOUND_UPLOAD) && (control_bits & 0xFFC0)) {
+        return false;
+    }
+
     // Get message's parity, i.e., the least significant bit (bit 0)
     bool parity_bit = message & 0x01;
 
@@ -57,4 +65,91 @@ uint32_t build_message(uint16_t control_bits) {
     // Calculate and set parity bit (LSB)
     bool parity = compute_parity(msg);
     return msg | parity; // set final bit to parity
-}
\ No newline at end of file
+}
+
+// Function to build a message with control bits and an 8-bit sound ID
+uint32_t build_message_sound(uint16_t control_bits, uint8_t sound_id) {
+    if (sound_id > 0x0F) {
+        control_bits |= SPEAKER_EXT_ID;
+    }
+
+    uint32_t msg = ((uint32_t)(control_bits) << 16) |
+                   ((uint32_t)(sound_id & 0x0F) << 12) |
+                   ((uint32_t)(sound_id >> 4) << 8);
+
+    // Calculate and set parity bit (LSB)
+    bool parity = compute_parity(msg);
+    return msg | parity; // set final bit to parity
+}
+
+// Function to read the sound ID of a message
+uint8_t read_message_sound(uint32_t message) {
+    uint8_t sound_id = (message >> 12) & 0x0F;
+
+    if ((message >> 16) & SPEAKER_EXT_ID) {
+        sound_id |= ((message >> 8) & 0x0F) << 4;
+    }
+    return sound_id;
+}
+
+// Function to build an LED_DIM message with control bits, speaker data and the fade
+uint32_t build_message_dim(uint16_t control_bits, uint8_t speaker_data,
+                           uint8_t led, uint8_t level, uint16_t fade_ms) {
+    // Smallest fade step that is not shorter than requested
+    uint8_t fade = 0;
+    if (fade_ms > 0) {
+        fade = 1;
+        while (fade < 7 && (125U << (fade - 1)) < fade_ms) {
+            fade++;
+        }
+    }
+
+    uint32_t msg = ((uint32_t)(control_bits | LED_DIM) << 16) |
+                   ((uint32_t)(speaker_data & 0x0F) << 12) |
+                   ((uint32_t)(led & 0x01) << 11) |
+                   ((uint32_t)(level >> 1) << 4) |
+                   ((uint32_t)fade << 1);
+
+    // Calculate and set parity bit (LSB)
+    bool parity = compute_parity(msg);
+    return msg | parity; // set final bit to parity
+}
+
+// Function to read the LED, brightness and fade time of an LED_DIM message
+void read_message_dim(uint32_t message, uint8_t *led, uint8_t *level, uint16_t *fade_ms) {
+    uint8_t fade = (message >> 1) & 0x07;
+    uint8_t level7 = (message >> 4) & 0x7F;
+
+    *led = (message >> 11) & 0x01;
+    *level = (level7 << 1) | (level7 >> 6); // 127 maps to 255
+    *fade_ms = fade ? (125U << (fade - 1)) : 0;
+}
+
+// Function to build a SOUND_UPLOAD message with its step, byte and value
+uint32_t build_message_upload(uint8_t step, uint8_t data, uint16_t value) {
+    uint32_t msg = ((uint32_t)(SOUND_UPLOAD | ((step & 0x03) << 3)) << 16);
+
+    if (step == UPLOAD_DATA) {
+        msg |= ((uint32_t)data << 8) | ((uint32_t)(value & 0x7F) << 1);
+    } else {
+        msg |= ((uint32_t)(data & 0x0F) << 12) | ((uint32_t)(value & 0x07FF) << 1);
+    }
+
+    // Calculate and set parity bit (LSB)
+    bool parity = compute_parity(msg);
+    return msg | parity; // set final bit to parity
+}
+
+// Function to read the step, byte and value of a SOUND_UPLOAD message
+uint8_t read_message_upload(uint32_t message, uint8_t *data, uint16_t *value) {
+    uint8_t step = (message >> 19) & 0x03;
+
+    if (step == UPLOAD_DATA) {
+        *data = (message >> 8) & 0xFF;
+        *value = (message >> 1) & 0x7F;
+    } else {
+        *data = (message >> 12) & 0x0F;
+        *value = (message >> 1) & 0x07FF;
+    }
+    return step;
+}
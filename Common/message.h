@@ -11,6 +11,26 @@
 |        Control Flags           | Spkr |      Unused    |Parity |
 |       (16 bits)                |(4b)  |     (11b)      | (1b)  |
 +--------------------------------+-------+-----------------------+
+
+With SPEAKER_EXT_ID set, bits 11-8 carry the high nibble of an 8-bit sound
+ID, bits 15-12 stay the low nibble. Cannot be combined with LED_DIM.
+
+With LED_DIM set, bits 11-1 carry the fade:
+  bit 11     LED (DIM_LED_MOVING, DIM_LED_DOOR)
+  bits 10-4  brightness, 0-127 (scaled to 0-255)
+  bits 3-1   fade time, 0 = at once, n = 125 ms << (n - 1), up to 8 s
+
+With SOUND_UPLOAD set, no other control bit 15-6 may be set. Control bits
+4-3 (message bits 20-19) give the upload step and bits 15-1 its data:
+  UPLOAD_BEGIN   bits 15-12 slot, bits 11-1 image length in bytes
+  UPLOAD_DATA    bits 15-8 image byte, bits 7-1 its offset in the image
+  UPLOAD_COMMIT  bits 15-12 slot
+  UPLOAD_ABORT   no data
+
+A sound image is the tempo (beats per minute), flags (UPLOAD_REPEAT),
+priority (0 background, 1 chime, 2 emergency), the melody bytes (format in
+Uno/Buzzer.h) and the CRC-16 of all bytes before it, high byte first. The
+CRC is _crc_ccitt_update() from util/crc16.h, starting at UPLOAD_CRC_INIT.
 */
 
 // Control bits for the message 16 bits
@@ -21,9 +41,33 @@ typedef enum {
     LED_DOOR_OPEN    = (1 << 12), // Bit 12: 0001 0000 0000 0000
     LED_DOOR_CLOSE   = (1 << 11), // Bit 11: 0000 1000 0000 0000
     SPEAKER_PLAY     = (1 << 10), // Bit 10: 0000 0100 0000 0000
-    SPEAKER_STOP     = (1 << 9)   // Bit 09: 0000 0010 0000 0000
+    SPEAKER_STOP     = (1 << 9),  // Bit 09: 0000 0010 0000 0000
+    EMERGENCY_STOP   = (1 << 8),  // Bit 08: 0000 0001 0000 0000, handled before anything else
+    LED_DIM          = (1 << 7),  // Bit 07: 0000 0000 1000 0000, fade an LED to a brightness
+    SPEAKER_EXT_ID   = (1 << 6),  // Bit 06: 0000 0000 0100 0000, 8-bit sound ID
+    SOUND_UPLOAD     = (1 << 5)   // Bit 05: 0000 0000 0010 0000, melody upload frame
 } MessageControlBits;
 
+// LEDs addressed by LED_DIM
+#define DIM_LED_MOVING 0
+#define DIM_LED_DOOR   1
+
+// SOUND_UPLOAD steps
+#define UPLOAD_BEGIN   0
+#define UPLOAD_DATA    1
+#define UPLOAD_COMMIT  2
+#define UPLOAD_ABORT   3
+
+#define UPLOAD_MAX_SIZE    128     // image bytes, the reach of the 7-bit offset
+#define UPLOAD_HEADER_SIZE 3       // tempo, flags, priority
+#define UPLOAD_CRC_SIZE    2
+#define UPLOAD_CRC_INIT    0xFFFF
+#define UPLOAD_REPEAT      0x01    // image flag: play until stopped
+#define UPLOAD_SLOTS       2
+#define UPLOAD_FIRST_SOUND 16      // sound ID of slot 0, sent with SPEAKER_EXT_ID
+
+#define UPLOAD_SOUND_ID(slot) (UPLOAD_FIRST_SOUND + (slot))
+
 /*
 * Function to check if a message is valid.
 * @return 1 if valid, 0 if invalid.
@@ -52,4 +96,54 @@ uint32_t build_message_data(uint16_t control_bits, uint8_t speaker_data);
 */
 uint32_t build_message(uint16_t control_bits);
 
+/*
+ * Function to build a message with control bits and a sound ID of up to
+ * 8 bits. SPEAKER_EXT_ID is added for IDs above 15, smaller IDs give the
+ * same message as build_message_data().
+ *
+ * example call
+ * build_message_sound(SPEAKER_PLAY, 42); // play sound 42
+*/
+uint32_t build_message_sound(uint16_t control_bits, uint8_t sound_id);
+
+/*
+ * Function to read the sound ID of a message, 8 bits with SPEAKER_EXT_ID,
+ * else 4 bits.
+*/
+uint8_t read_message_sound(uint32_t message);
+
+/*
+ * Function to build an LED_DIM message, LED_DIM is added to the control bits.
+ * The brightness is sent with 7 bits and the fade time is rounded up to the
+ * next step of the 125 ms * 2^n scale.
+ *
+ * example call
+ * build_message_dim(SPEAKER_PLAY, 1, DIM_LED_DOOR, 255, 1000); // door LED up in 1 s, sound 1
+*/
+uint32_t build_message_dim(uint16_t control_bits, uint8_t speaker_data,
+                           uint8_t led, uint8_t level, uint16_t fade_ms);
+
+/*
+ * Function to read the fade of an LED_DIM message.
+ * The brightness is returned as 0-255 and the fade time in milliseconds.
+*/
+void read_message_dim(uint32_t message, uint8_t *led, uint8_t *level, uint16_t *fade_ms);
+
+/*
+ * Functions to build the SOUND_UPLOAD messages of an upload: UPLOAD_BEGIN
+ * with the slot and the image length, an UPLOAD_DATA per image byte and
+ * UPLOAD_COMMIT with the slot again.
+ *
+ * example call
+ * build_message_upload(UPLOAD_DATA, 0x42, 5); // image byte 5 is 0x42
+*/
+uint32_t build_message_upload(uint8_t step, uint8_t data, uint16_t value);
+
+/*
+ * Function to read a SOUND_UPLOAD message. Returns the step; data is the
+ * slot (UPLOAD_BEGIN, UPLOAD_COMMIT) or the image byte (UPLOAD_DATA), value
+ * the image length (UPLOAD_BEGIN) or the offset of the byte (UPLOAD_DATA).
+*/
+uint8_t read_message_upload(uint32_t message, uint8_t *data, uint16_t *value);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stddef.h>
+
+#include "systick.h"
+
+// Each overflow is 1.024 ms: count 1 ms and carry the remaining 24 us in
+// units of 8 us (3/125 ms) to keep millis exact over time
+#define MILLIS_INC  1
+#define FRACT_INC   3
+#define FRACT_MAX   125
+
+static volatile uint32_t tick_count = 0;
+static volatile uint32_t millis_count = 0;
+static volatile uint8_t millis_fract = 0;
+
+static systick_callback_t callbacks[SYSTICK_MAX_CALLBACKS];
+static uint8_t callback_count = 0;
+
+void SYSTICK_init(void) {
+    TCNT0 = 0;
+    // Fast PWM mode 3 (TOP = 0xFF), see datasheet p.104
+    TCCR0A = (1 << WGM01) | (1 << WGM00);
+    // Prescaler 64: 16MHz / 64 = 250kHz, overflow every 256 counts = 1024 us
+    TCCR0B = (1 << CS01) | (1 << CS00);
+    // Enable overflow interrupt
+    TIMSK0 |= (1 << TOIE0);
+
+    sei();
+}
+
+bool SYSTICK_add_callback(systick_callback_t callback) {
+    if (callback == NULL || callback_count >= SYSTICK_MAX_CALLBACKS) {
+        return false;
+    }
+
+    uint8_t sreg = SREG;
+    cli();
+    callbacks[callback_count++] = callback;
+    SREG = sreg;
+
+    return true;
+}
+
+uint32_t SYSTICK_ticks(void) {
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t ticks = tick_count;
+    SREG = sreg;
+
+    return ticks;
+}
+
+uint32_t SYSTICK_millis(void) {
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t ms = millis_count;
+    SREG = sreg;
+
+    return ms;
+}
+
+uint32_t SYSTICK_micros(void) {
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t ticks = tick_count;
+    uint8_t count = TCNT0;
+
+    // Account for an overflow that happened while interrupts were disabled
+    if ((TIFR0 & (1 << TOV0)) && (count < 255)) {
+        ticks++;
+    }
+    SREG = sreg;
+
+    // 4 us per timer count, 256 counts per tick
+    return ((ticks << 8) + count) * 4;
+}
+
+// Timer0 overflow interrupt - system tick
+ISR(TIMER0_OVF_vect) {
+    uint32_t ms = millis_count + MILLIS_INC;
+    uint8_t fract = millis_fract + FRACT_INC;
+
+    if (fract >= FRACT_MAX) {
+        fract -= FRACT_MAX;
+        ms++;
+    }
+
+    millis_count = ms;
+    millis_fract = fract;
+    tick_count++;
+
+    for (uint8_t i = 0; i < callback_count; i++) {
+        callbacks[i]();
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef SYSTICK_H
+#define SYSTICK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * System tick on Timer0
+ *
+ * Timer0 runs in fast PWM mode (TOP = 0xFF) with a /64 prescaler, so the
+ * overflow interrupt fires every 256 * 4 us = 1024 us. The overflow is used
+ * as the system tick; millisecond time is kept exact with a fractional
+ * accumulator. Both OC0A and OC0B stay free for PWM output.
+ *
+ * Timer0 and its registers are identical on the ATmega328P and ATmega2560,
+ * so the same module runs on both boards.
+ */
+
+#define SYSTICK_US_PER_TICK  1024U
+
+// Maximum number of functions that can be hooked into the tick interrupt
+#define SYSTICK_MAX_CALLBACKS 4
+
+// Tick callback type definition, called from the Timer0 overflow interrupt
+typedef void (*systick_callback_t)(void);
+
+/**
+ * @brief Initialize Timer0 as the system tick
+ *
+ * Configures fast PWM mode with /64 prescaler and enables the overflow
+ * interrupt. Global interrupts are enabled.
+ */
+void SYSTICK_init(void);
+
+/**
+ * @brief Register a function to be called on every tick
+ * @param callback Function to call from the tick interrupt
+ * @return true if registered, false if all slots are taken
+ *
+ * Callbacks run in interrupt context and must be short and non-blocking.
+ */
+bool SYSTICK_add_callback(systick_callback_t callback);
+
+/**
+ * @brief Get the number of ticks since SYSTICK_init()
+ * @return Tick count (one tick = SYSTICK_US_PER_TICK microseconds)
+ */
+uint32_t SYSTICK_ticks(void);
+
+/**
+ * @brief Get milliseconds since SYSTICK_init()
+ * @return Elapsed time in milliseconds
+ */
+uint32_t SYSTICK_millis(void);
+
+/**
+ * @brief Get microseconds since SYSTICK_init()
+ * @return Elapsed time in microseconds (4 us resolution)
+ *
+ * Safe to call from interrupt context.
+ */
+uint32_t SYSTICK_micros(void);
+
+#endif
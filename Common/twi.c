@@ -10,8 +10,14 @@ static volatile uint8_t twi_bytes_received = 0;
 static twi_message_callback_t message_callback = NULL;
 static volatile bool message_complete = false;
 
+// Urgent message posted with TWI_post_urgent(), sent by TWI_flush_urgent()
+static volatile bool urgent_pending = false;
+static volatile uint32_t urgent_message = 0;
+
 // Private helper function prototypes
 static void process_received_byte(uint8_t data);
+static uint8_t transmit_message(uint32_t data, bool verbose);
+static bool wait_twint(void);
 
 void TWI_set_callback(twi_message_callback_t callback) {
     message_callback = callback;
@@ -52,12 +58,25 @@ void TWI_enable_interrupt(bool enable) {
     }
 }
 
+// Wait for the current bus operation; a slave that holds SCL low or a bus
+// without pull-ups must not hang the caller, so give up after a while
+static bool wait_twint(void) {
+    for (uint16_t n = TWI_TIMEOUT_LOOPS; n != 0; n--) {
+        if (TWCR & (1 << TWINT)) return true;
+    }
+    
+    // Abort the transfer and release the bus lines
+    TWCR = 0;
+    TWCR = (1 << TWEN);
+    return false;
+}
+
 uint8_t TWI_start(void) {
     // Step 1 - Send START condition by setting TWINT, TWSTA and TWEN bits (datasheet p.246)
     TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
     
     // Step 2 - Wait for TWINT flag to be set, indicating START has been transmitted
-    while (!(TWCR & (1 << TWINT)));
+    if (!wait_twint()) return TWI_TIMEOUT;
     
     // Check if START was transmitted successfully
     uint8_t status = TWSR & 0xF8;
@@ -73,7 +92,7 @@ uint8_t TWI_start(void) {
     TWCR = (1 << TWINT) | (1 << TWEN);
     
     // Step 5 - Wait for TWINT flag to be set, indicating address has been transmitted
-    while (!(TWCR & (1 << TWINT)));
+    if (!wait_twint()) return TWI_TIMEOUT;
     
     // Step 6 - Return status register value to check if slave responded with ACK
     return TWSR & 0xF8;
@@ -83,7 +102,7 @@ uint8_t TWI_start_read(void) {
     // Similar to TWI_start but for read operations
     TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
     
-    while (!(TWCR & (1 << TWINT)));
+    if (!wait_twint()) return TWI_TIMEOUT;
     
     uint8_t status = TWSR & 0xF8;
     if (status != 0x08 && status != 0x10) {
@@ -97,7 +116,7 @@ uint8_t TWI_start_read(void) {
     TWCR = (1 << TWINT) | (1 << TWEN);
     
     // Wait for completion
-    while (!(TWCR & (1 << TWINT)));
+    if (!wait_twint()) return TWI_TIMEOUT;
     
     // Return status
     return TWSR & 0xF8;
@@ -111,7 +130,7 @@ uint8_t TWI_write(uint8_t data) {
     TWCR = (1 << TWINT) | (1 << TWEN);
     
     // Step 3 - Wait for TWINT flag to be set, indicating data has been transmitted
-    while (!(TWCR & (1 << TWINT)));
+    if (!wait_twint()) return TWI_TIMEOUT;
     
     // Step 4 - Return status register value to check if slave responded with ACK
     return TWSR & 0xF8;
@@ -123,7 +142,7 @@ void TWI_stop(void) {
     
     // No need to wait for TWINT here - TWINT is not set after a STOP condition
     // But we can wait until the STOP condition is executed
-    while (TWCR & (1 << TWSTO));
+    for (uint16_t n = TWI_TIMEOUT_LOOPS; n != 0 && (TWCR & (1 << TWSTO)); n--);
 }
 
 uint8_t TWI_get_status(void) {
@@ -171,15 +190,15 @@ static void process_received_byte(uint8_t data) {
     }
 }
 
-// Send a message to the slave
-uint8_t TWI_send_message(uint32_t data) {
+// Transmit one message as master, optionally printing debug output
+static uint8_t transmit_message(uint32_t data, bool verbose) {
     uint8_t status;
     
     /* Send START condition and SLA+W */
-    printf("Sending START + address 0x%02X\n", SLAVE_ADDRESS);
+    if (verbose) printf("Sending START + address 0x%02X\n", SLAVE_ADDRESS);
     status = TWI_start();
     if (status != 0x18) { // SLA+W sent, ACK received
-        printf("START failed: 0x%02X\n", status);
+        if (verbose) printf("START failed: 0x%02X\n", status);
         TWI_stop();
         return status; // Return error code
     }
@@ -187,20 +206,20 @@ uint8_t TWI_send_message(uint32_t data) {
     /* Send data bytes (little-endian order) */
     for (uint8_t i = 0; i < 4; i++) {
         uint8_t byte = (data >> (8*i)) & 0xFF;
-        printf("Sending byte %d: 0x%02X\n", i, byte);
+        if (verbose) printf("Sending byte %d: 0x%02X\n", i, byte);
         status = TWI_write(byte);
         
         // For the last byte (i=3), accept either ACK (0x28) or NACK (0x30)
         if (i == 3) {
             if (status != 0x28 && status != 0x30) {
-                printf("Write failed at byte %d: 0x%02X\n", i, status);
+                if (verbose) printf("Write failed at byte %d: 0x%02X\n", i, status);
                 TWI_stop();
                 return 0x40 + i; // Error code indicating which byte failed
             }
         } else {
             // For bytes 0-2, require ACK (0x28)
             if (status != 0x28) {
-                printf("Write failed at byte %d: 0x%02X\n", i, status);
+                if (verbose) printf("Write failed at byte %d: 0x%02X\n", i, status);
                 TWI_stop();
                 return 0x40 + i; // Error code indicating which byte failed
             }
@@ -208,12 +227,51 @@ uint8_t TWI_send_message(uint32_t data) {
     }
     
     /* Send STOP condition */
-    printf("Sending STOP\n");
+    if (verbose) printf("Sending STOP\n");
     TWI_stop();
     
     return 0; // Success
 }
 
+// Send a message to the slave
+uint8_t TWI_send_message(uint32_t data) {
+    uint8_t status = transmit_message(data, true);
+    
+    // Urgent messages posted during the transfer go out before anything else
+    TWI_flush_urgent();
+    
+    return status;
+}
+
+// Send a message to the slave without debug output
+uint8_t TWI_send_message_quiet(uint32_t data) {
+    uint8_t status = transmit_message(data, false);
+    
+    TWI_flush_urgent();
+    
+    return status;
+}
+
+void TWI_post_urgent(uint32_t data) {
+    uint8_t sreg = SREG;
+    cli();
+    urgent_message = data;
+    urgent_pending = true;
+    SREG = sreg;
+}
+
+void TWI_flush_urgent(void) {
+    while (urgent_pending) {
+        uint8_t sreg = SREG;
+        cli();
+        uint32_t data = urgent_message;
+        urgent_pending = false;
+        SREG = sreg;
+        
+        transmit_message(data, false);
+    }
+}
+
 // TWI Interrupt Service Routine
 ISR(TWI_vect) {
     uint8_t status = TWI_get_status();
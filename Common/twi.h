@@ -8,6 +8,12 @@
 // Default slave address for TWI communication
 #define SLAVE_ADDRESS 0x57
 
+// Busy-wait limit for one bus operation, about 2 ms
+#define TWI_TIMEOUT_LOOPS 4000
+
+// Status returned when the bus did not respond within TWI_TIMEOUT_LOOPS
+#define TWI_TIMEOUT 0xFF
+
 // Message handling callback type definition
 typedef void (*twi_message_callback_t)(uint32_t message);
 
@@ -35,7 +41,7 @@ void TWI_init_slave(void);
 
 /**
  * @brief Send START condition and slave write address
- * @return TWSR status code (see datasheet p.262)
+ * @return TWSR status code (see datasheet p.262), TWI_TIMEOUT if the bus hangs
  * 
  * Sends START condition followed by SLAVE_ADDRESS with write bit (SLA+W)
  */
@@ -43,7 +49,7 @@ uint8_t TWI_start(void);
 
 /**
  * @brief Send START condition and slave read address
- * @return TWSR status code (see datasheet p.262)
+ * @return TWSR status code (see datasheet p.262), TWI_TIMEOUT if the bus hangs
  * 
  * Sends START condition followed by SLAVE_ADDRESS with read bit (SLA+R)
  */
@@ -52,7 +58,7 @@ uint8_t TWI_start_read(void);
 /**
  * @brief Write data byte to TWI bus
  * @param data Byte to transmit
- * @return TWSR status code (see datasheet p.262)
+ * @return TWSR status code (see datasheet p.262), TWI_TIMEOUT if the bus hangs
  */
 uint8_t TWI_write(uint8_t data);
 
@@ -106,4 +112,31 @@ uint32_t TWI_get_last_message(void);
  */
 uint8_t TWI_send_message(uint32_t data);
 
+/**
+ * @brief Send a 32-bit message without debug output
+ * @param data The 32-bit message to send
+ * @return 0 on success, error code otherwise
+ *
+ * As TWI_send_message(), for streams of frames such as a melody upload.
+ */
+uint8_t TWI_send_message_quiet(uint32_t data);
+
+/**
+ * @brief Post a high-priority message that preempts normal traffic
+ * @param data The 32-bit message to send
+ *
+ * Safe to call from interrupt context: the message is only latched, never
+ * sent from here. It goes out from TWI_flush_urgent(), or right after the
+ * STOP of the next TWI_send_message(), ahead of any later message. A newer
+ * urgent message replaces an older one that has not been sent yet.
+ */
+void TWI_post_urgent(uint32_t data);
+
+/**
+ * @brief Send the message posted with TWI_post_urgent(), if any
+ *
+ * Call from the main loop, not from interrupts.
+ */
+void TWI_flush_urgent(void);
+
 #endif
\ No newline at end of file
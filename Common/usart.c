@@ -51,9 +51,15 @@ int USART_getchar(FILE *stream) {
 void USART_transmit(uint8_t data) {
     /* Wait until the transmit buffer is empty*///datasheet p.207, p. 219
     while(!(UCSR0A & (1 << UDRE0)));
+    UCSR0A |= (1 << TXC0); // clear transmit complete, set again once this byte is out
     UDR0 = data;
 }
 
+bool USART_transmit_complete(void) {
+    // TXC0 is cleared by USART_transmit() and set by hardware when the frame is out
+    return (UCSR0A & (1 << TXC0)) || !(UCSR0B & (1 << TXEN0));
+}
+
 void USART_print_string(const char* str) {
     while(*str) {
         USART_transmit(*str++);
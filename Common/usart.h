@@ -48,6 +48,14 @@ void USART_init(uint32_t baudrate);
  */
 void USART_transmit(uint8_t data);
 
+/**
+ * @brief Check if the transmitter has shifted out the last byte
+ * @return true if nothing is left in the transmit buffer or shift register
+ *
+ * Used before entering a sleep mode that stops the USART clock.
+ */
+bool USART_transmit_complete(void);
+
 /**
  * @brief Print a string to USART
  * @param str Zero-terminated string to transmit
@@ -0,0 +1,115 @@
+/*
+ * emergency.c
+ *
+ * Emergency stop path: the INT3 interrupt latches the request and posts an
+ * urgent stop frame for the UNO, which the main loop sends; the next system
+ * tick stops the motion and records the button-edge-to-stop latency.
+ */
+
+#include "pins.h"
+#include "emergency.h"
+#include "motion.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Common includes
+#include "systick.h"
+#include "twi.h"
+#include "message.h"
+
+static emergency_callback_t latch_callback = NULL;
+
+static volatile bool latched = false;
+static volatile bool motion_stopped = false;
+static volatile uint32_t edge_us = 0;
+
+static volatile EmergencyStats stats = {0, 0, 0};
+
+// Runs on every system tick: stops motion on the first tick after the edge
+static void emergency_tick(void) {
+    if (!latched || motion_stopped) {
+        return;
+    }
+
+    MOTION_emergency_stop();
+    motion_stopped = true;
+
+    uint32_t latency = SYSTICK_micros() - edge_us;
+    stats.last_us = latency;
+    if (latency > stats.worst_us) {
+        stats.worst_us = latency;
+    }
+    stats.count++;
+}
+
+void EMERGENCY_init(emergency_callback_t on_latch) {
+    latch_callback = on_latch;
+    latched = false;
+    motion_stopped = false;
+
+    SYSTICK_add_callback(emergency_tick);
+
+    EMERGENCY_INT_DDR &= ~(1 << EMERGENCY_INT_PIN); // clears the bit, setting the pin as an input.
+    EMERGENCY_INT_PORT |= (1 << EMERGENCY_INT_PIN); // enables the internal pull-up resistor, keeping the pin HIGH when idle.
+    EICRA |= (1 << ISC31);    // combination 1,1 sets button to trigger when LOW --> HIGH
+    EICRA |= (1 << ISC30);
+
+    EIFR = (1 << INTF3);      // Discard any edge seen before we were ready
+    EIMSK |= (1 << INT3);     // Enable INT3 interrupt
+
+    sei();                    // Enable global interrupts
+}
+
+bool EMERGENCY_is_latched(void) {
+    return latched;
+}
+
+bool EMERGENCY_motion_stopped(void) {
+    return motion_stopped;
+}
+
+void EMERGENCY_clear(void) {
+    uint8_t sreg = SREG;
+    cli();
+    latched = false;
+    motion_stopped = false;
+    SREG = sreg;
+}
+
+void EMERGENCY_get_stats(EmergencyStats *out) {
+    uint8_t sreg = SREG;
+    cli();
+    out->last_us = stats.last_us;
+    out->worst_us = stats.worst_us;
+    out->count = stats.count;
+    SREG = sreg;
+}
+
+void EMERGENCY_report(void) {
+    EmergencyStats copy;
+    EMERGENCY_get_stats(&copy);
+
+    printf("Emergency stops: %u, last latency: %lu us, worst: %lu us\n",
+           copy.count, copy.last_us, copy.worst_us);
+}
+
+/* Interrupt Service Routine for Emergency Button */
+ISR(INT3_vect) {
+    // Further edges are ignored until the emergency is resolved
+    if (latched) {
+        return;
+    }
+
+    edge_us = SYSTICK_micros();
+    latched = true;
+
+    // Only latched here; sent by the main loop ahead of any other message
+    TWI_post_urgent(build_message(EMERGENCY_STOP));
+
+    if (latch_callback != NULL) {
+        latch_callback();
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * emergency.h
+ *
+ * Emergency stop path: the INT3 interrupt latches the request and posts an
+ * urgent stop frame for the UNO, which the main loop sends; the next system
+ * tick stops the motion and records the button-edge-to-stop latency.
+ */
+
+#ifndef EMERGENCY_H
+#define EMERGENCY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Callback type definition, called from the INT3 interrupt when the latch is set
+typedef void (*emergency_callback_t)(void);
+
+// Latency statistics, all times in microseconds
+typedef struct {
+    uint32_t last_us;   // latency of the most recent stop
+    uint32_t worst_us;  // worst latency seen since power-on
+    uint16_t count;     // number of stops measured
+} EmergencyStats;
+
+/**
+ * @brief Initialize the emergency button interrupt and stop handler
+ * @param on_latch Function to call from interrupt context when the
+ *                 emergency latch is set, may be NULL
+ *
+ * Requires SYSTICK_init() to have been called.
+ */
+void EMERGENCY_init(emergency_callback_t on_latch);
+
+/**
+ * @brief Check if an emergency is latched
+ * @return true from the button edge until EMERGENCY_clear()
+ */
+bool EMERGENCY_is_latched(void);
+
+/**
+ * @brief Check if motion has been stopped by the emergency path
+ * @return true once the tick after the button edge has halted motion
+ */
+bool EMERGENCY_motion_stopped(void);
+
+/**
+ * @brief Release the emergency latch
+ *
+ * Call after the emergency has been resolved to re-arm the button.
+ */
+void EMERGENCY_clear(void);
+
+/**
+ * @brief Get a consistent copy of the latency statistics
+ * @param stats Destination for the statistics
+ */
+void EMERGENCY_get_stats(EmergencyStats *stats);
+
+/**
+ * @brief Print the latency statistics to the debug console
+ */
+void EMERGENCY_report(void);
+
+#endif
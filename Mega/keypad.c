@@ -72,6 +72,10 @@ Errors and omissions should be reported to codelibraries@exploreembedded.com
  ****************************************************************************************************/
 
 #include "keypad.h"
+#include "idle.h"
+#include "systick.h"
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 
 
 
@@ -79,7 +83,59 @@ Errors and omissions should be reported to codelibraries@exploreembedded.com
 /***************************************************************************************************
                            local function prototypes
  ***************************************************************************************************/
-static uint8_t keypad_ScanKey();
+static uint8_t keypad_KeyFromMap(uint16_t var_keyMap_u16);
+static void keypad_ScannerTick();
+/**************************************************************************************************/
+
+
+
+
+/***************************************************************************************************
+                           Background scanner state
+ ***************************************************************************************************
+ The scanner is idle while no key is pressed: all rows are driven low and a pin change interrupt
+ on the column lines starts it. While it runs, the system tick reads the full matrix with
+ KEYPAD_ScanMatrix (about 25 us) and skips frames with ghost keys. Each key has its own debounce
+ state machine:
+
+     UP --change seen--> DOWN_PENDING --stable C_KeypadDebounceMs_U8--> DOWN (press event)
+     DOWN --change seen--> UP_PENDING --stable C_KeypadDebounceMs_U8--> UP (release event)
+
+ A pending key that reads back its old state before the debounce time returns to it without an
+ event. Once every key is UP the scanner stops and the pin change interrupt is armed again.
+ ***************************************************************************************************/
+#define C_KeyUp_U8           0u
+#define C_KeyDownPending_U8  1u
+#define C_KeyDown_U8         2u
+#define C_KeyUpPending_U8    3u
+
+static uint8_t var_keyState_au8[C_KeypadKeys_U8];
+static uint32_t var_keySince_au32[C_KeypadKeys_U8];     // time the pending change was first seen
+
+static volatile uint8_t var_scanActive_u8 = 0;
+static volatile uint16_t var_ghostFrames_u16 = 0;       // scans skipped for ghost keys
+
+static KEYPAD_Event_st var_eventQueue_ast[C_KeypadEventQueueSize_U8];
+static volatile uint8_t var_eventHead_u8 = 0;
+static volatile uint8_t var_eventTail_u8 = 0;
+/**************************************************************************************************/
+
+
+
+
+/***************************************************************************************************
+                           Key map
+ ***************************************************************************************************
+ ASCII value of every key, indexed by the bit of the key in the map of KEYPAD_ScanMatrix:
+ bit (4*ROW + COL).
+ ***************************************************************************************************/
+static const uint8_t C_KeyMap_au8[C_KeypadKeys_U8] PROGMEM =
+{
+	'1', '4', '7', '*',     // R0: C0..C3
+	'2', '5', '8', '0',     // R1
+	'3', '6', '9', '#',     // R2
+	'A', 'B', 'C', 'D'      // R3
+};
 /**************************************************************************************************/
 
 
@@ -122,6 +178,8 @@ void KEYPAD_WaitForKeyRelease()
 		{
 			M_ROW=0x0F;           // Pull the ROW lines to low and Column lines high.
 			key=M_COL & 0x0F;     // Read the Columns, to check the key press
+			if(key!=0x0F)
+				IDLE_sleep(false);    // Nothing to do until the next tick
 		}while(key!=0x0F);
 
 		_delay_ms(1);
@@ -155,6 +213,8 @@ void KEYPAD_WaitForKeyPress()
 		{
 			M_ROW=0x0F;		  // Pull the ROW lines to low and Column lines high.
 			var_keyPress_u8=M_COL & 0x0F;	  // Read the Columns, to check the key press
+			if(var_keyPress_u8==0x0F)
+				IDLE_sleep(false);	  // Nothing to do until the next tick
 		}while(var_keyPress_u8==0x0F); // Wait till the Key is pressed,
 		// if a Key is pressed the corresponding Column line go low
 
@@ -185,8 +245,8 @@ void KEYPAD_WaitForKeyPress()
                 It follows the following sequences to decode the key pressed:
 				1.Wait till the previous key is released..
 				2.Wait for the new key press.
-				3.Scan all the rows one at a time for the pressed key.
-				4.Decodes the key pressed depending on ROW-COL combination and returns its
+				3.Scan the whole matrix in one pass (KEYPAD_ScanMatrix).
+				4.Decodes the lowest key pressed through the key map and returns its
 				  ASCII value.
  ***************************************************************************************************/
 uint8_t KEYPAD_GetKey()
@@ -197,29 +257,180 @@ uint8_t KEYPAD_GetKey()
 	_delay_ms(1);
 
 	KEYPAD_WaitForKeyPress();      // Wait for the new key press
-	var_keyPress_u8 = keypad_ScanKey();        // Scan for the key pressed.
+	var_keyPress_u8 = keypad_KeyFromMap(KEYPAD_ScanMatrix(NULL)); // Scan and decode the key pressed
+	return(var_keyPress_u8);                      // Return the key
+}
+
+
 
-	switch(var_keyPress_u8)                       // Decode the key
+
+
+
+/***************************************************************************************************
+                   void KEYPAD_StartScanner()
+ ***************************************************************************************************
+ * I/P Arguments:none
+
+ * Return value	: none
+
+ * description: Starts the background scanner, see above. Key presses and releases are then read
+                with KEYPAD_GetEvent; the blocking functions must not be used any more. Requires
+                KEYPAD_Init and the system tick (SYSTICK_init).
+ ***************************************************************************************************/
+void KEYPAD_StartScanner()
+{
+	uint8_t i;
+
+	for(i=0;i<C_KeypadKeys_U8;i++)
+		var_keyState_au8[i] = C_KeyUp_U8;
+
+	M_ROW=0x0F;                   // All ROW lines low: any key pulls its Column low
+	PCMSK2 |= 0x0F;               // PCINT16..19 on the Column lines PK0..PK3
+	PCIFR = (1<<PCIF2);           // Forget changes from before
+	PCICR |= (1<<PCIE2);
+
+	SYSTICK_add_callback(keypad_ScannerTick);
+}
+
+
+
+
+
+
+/***************************************************************************************************
+                   uint8_t KEYPAD_GetEvent(KEYPAD_Event_st *ptr_event_st)
+ ***************************************************************************************************
+ * I/P Arguments: KEYPAD_Event_st *--> Receives the oldest event
+
+ * Return value	: uint8_t--> 1 if an event was returned, 0 if the queue is empty
+
+ * description: Non-blocking read of the debounced press and release events of the background
+                scanner. Events are dropped while the queue is full.
+ ***************************************************************************************************/
+uint8_t KEYPAD_GetEvent(KEYPAD_Event_st *ptr_event_st)
+{
+	uint8_t var_sreg_u8;
+
+	if(var_eventTail_u8 == var_eventHead_u8)
+		return 0;
+
+	var_sreg_u8 = SREG;
+	cli();                        // The event is written from the tick interrupt
+	*ptr_event_st = var_eventQueue_ast[var_eventTail_u8];
+	var_eventTail_u8 = (var_eventTail_u8 + 1) & (C_KeypadEventQueueSize_U8 - 1);
+	SREG = var_sreg_u8;
+
+	return 1;
+}
+
+
+
+
+
+
+/***************************************************************************************************
+                     static void keypad_PushEvent(uint8_t var_keyIndex_u8, uint8_t var_pressed_u8)
+ ***************************************************************************************************
+ * description  : Queues an event from the tick interrupt.
+ ***************************************************************************************************/
+static void keypad_PushEvent(uint8_t var_keyIndex_u8, uint8_t var_pressed_u8)
+{
+	uint8_t var_next_u8 = (var_eventHead_u8 + 1) & (C_KeypadEventQueueSize_U8 - 1);
+
+	if(var_next_u8 == var_eventTail_u8)
+		return;                   // Queue full, the main loop is not reading
+
+	var_eventQueue_ast[var_eventHead_u8].key = pgm_read_byte(&C_KeyMap_au8[var_keyIndex_u8]);
+	var_eventQueue_ast[var_eventHead_u8].pressed = var_pressed_u8;
+	var_eventQueue_ast[var_eventHead_u8].time_ms = var_keySince_au32[var_keyIndex_u8];
+	var_eventHead_u8 = var_next_u8;
+}
+
+
+
+
+
+
+/***************************************************************************************************
+                     static void keypad_ScannerTick()
+ ***************************************************************************************************
+ * description  : System tick callback: scans the matrix and runs the debounce state machine of
+                  every key, stops the scanner once all keys are released.
+ ***************************************************************************************************/
+static void keypad_ScannerTick()
+{
+	uint8_t i, var_down_u8, var_ghost_u8, var_allUp_u8 = 1;
+	uint16_t var_keyMap_u16;
+	uint32_t var_now_u32;
+
+	if(!var_scanActive_u8)
+		return;
+
+	var_keyMap_u16 = KEYPAD_ScanMatrix(&var_ghost_u8);
+	if(var_ghost_u8)
 	{
-	case 0xe7: var_keyPress_u8='*'; break; 
-	case 0xeb: var_keyPress_u8='7'; break; 
-	case 0xed: var_keyPress_u8='4'; break; 
-	case 0xee: var_keyPress_u8='1'; break; 
-	case 0xd7: var_keyPress_u8='0'; break; 
-	case 0xdb: var_keyPress_u8='8'; break; 
-	case 0xdd: var_keyPress_u8='5'; break; 
-	case 0xde: var_keyPress_u8='2'; break; 
-	case 0xb7: var_keyPress_u8='#'; break; 
-	case 0xbb: var_keyPress_u8='9'; break; 
-	case 0xbd: var_keyPress_u8='6'; break; 
-	case 0xbe: var_keyPress_u8='3'; break; 
-	case 0x77: var_keyPress_u8='D'; break;  
-	case 0x7b: var_keyPress_u8='C'; break;  
-	case 0x7d: var_keyPress_u8='B'; break;  
-	case 0x7e: var_keyPress_u8='A'; break;  
-	default  : var_keyPress_u8='z'; break;
+		var_ghostFrames_u16++;    // Cannot tell which keys are down, keep the last state
+		return;
+	}
+
+	var_now_u32 = SYSTICK_millis();
+	for(i=0;i<C_KeypadKeys_U8;i++)
+	{
+		var_down_u8 = var_keyMap_u16 & 0x01;
+		var_keyMap_u16 >>= 1;
+
+		switch(var_keyState_au8[i])
+		{
+		case C_KeyUp_U8:
+			if(var_down_u8)
+			{
+				var_keyState_au8[i] = C_KeyDownPending_U8;
+				var_keySince_au32[i] = var_now_u32;
+			}
+			break;
+		case C_KeyDownPending_U8:
+			if(!var_down_u8)
+				var_keyState_au8[i] = C_KeyUp_U8;          // Bounce
+			else if((var_now_u32 - var_keySince_au32[i]) >= C_KeypadDebounceMs_U8)
+			{
+				var_keyState_au8[i] = C_KeyDown_U8;
+				keypad_PushEvent(i, 1);
+			}
+			break;
+		case C_KeyDown_U8:
+			if(!var_down_u8)
+			{
+				var_keyState_au8[i] = C_KeyUpPending_U8;
+				var_keySince_au32[i] = var_now_u32;
+			}
+			break;
+		default: // C_KeyUpPending_U8
+			if(var_down_u8)
+				var_keyState_au8[i] = C_KeyDown_U8;        // Bounce
+			else if((var_now_u32 - var_keySince_au32[i]) >= C_KeypadDebounceMs_U8)
+			{
+				var_keyState_au8[i] = C_KeyUp_U8;
+				keypad_PushEvent(i, 0);
+			}
+			break;
+		}
+
+		if(var_keyState_au8[i] != C_KeyUp_U8)
+			var_allUp_u8 = 0;
+	}
+
+	if(var_allUp_u8)
+	{
+		// KEYPAD_ScanMatrix left all ROW lines low
+		_delay_us(C_KeypadSettleUs_U8);
+		PCIFR = (1<<PCIF2);       // The scan itself toggled the Columns
+		if((M_COL & 0x0F) == 0x0F)
+		{
+			var_scanActive_u8 = 0;
+			PCICR |= (1<<PCIE2);  // An edge from now on sets PCIF2 again
+		}
+		// else a key went down after the scan: no edge will come for it, keep scanning
 	}
-	return(var_keyPress_u8);                      // Return the key
 }
 
 
@@ -228,35 +439,109 @@ uint8_t KEYPAD_GetKey()
 
 
 /***************************************************************************************************
-                     static uint8_t keypad_ScanKey()
+                     ISR(PCINT2_vect)
  ***************************************************************************************************
- * I/P Arguments:none
+ * description  : A Column line changed while the scanner was idle: scan from the next tick on.
+ ***************************************************************************************************/
+ISR(PCINT2_vect)
+{
+	PCICR &= ~(1<<PCIE2);         // The scan toggles the Columns, ignore them until it stops
+	var_scanActive_u8 = 1;
+}
+
+
+
+
 
- * Return value	: uint8_t--> Scancode of the Key Pressed
 
- * description  : This function scans all the rows to decode the key pressed.
-        1.Each time a ROW line is pulled low to detect the KEY.
-        2.Column Lines are read to check the key press.
-        3.If any Key is pressed then corresponding Column Line goes low.
+/***************************************************************************************************
+                     uint16_t KEYPAD_ScanMatrix(uint8_t *ptr_ghost_u8)
+ ***************************************************************************************************
+ * I/P Arguments: uint8_t *--> Set to 1 if the map is ambiguous (ghost keys), may be NULL
+
+ * Return value	: uint16_t--> Map of the keys pressed, bit (4*ROW + COL)
 
-        4.Return the ScanCode(Combination of ROW & COL) for decoding the key.
+ * description  : Reads all four rows in one pass.
+        1.Each ROW line is pulled low in turn, the Columns settle for C_KeypadSettleUs_U8 us.
+        2.The Columns read low for the keys pressed on that ROW.
+        3.All ROW lines are left low, as for the key press detection.
+
+        Without diodes in the matrix, three keys on the corners of a rectangle also pull the
+        fourth corner low: whenever two rows share two or more pressed columns, it cannot be
+        told which of them are really pressed, and *ptr_ghost_u8 is set.
+        About 25 us at 16 MHz, instead of 4 ms with a 1 ms settle time per row.
  ***************************************************************************************************/
-static uint8_t keypad_ScanKey()
+uint16_t KEYPAD_ScanMatrix(uint8_t *ptr_ghost_u8)
 {
+	uint8_t var_row_au8[4], i, j, var_common_u8, var_ghost_u8 = 0;
+	uint16_t var_keyMap_u16 = 0;
 
-	uint8_t var_keyScanCode_u8 = 0xEF,i, var_keyPress_u8;
+	for(i=0;i<0x04;i++)
+	{
+		M_ROW = ~(0x10 << i);            // Select 1-Row, Column pull-ups stay on
+		_delay_us(C_KeypadSettleUs_U8);
+		var_row_au8[i] = ~M_COL & 0x0F;  // 1: key pressed
+		var_keyMap_u16 |= (uint16_t)var_row_au8[i] << (i * 4);
+	}
+	M_ROW = 0x0F;
 
-	for(i=0;i<0x04;i++)                // Scan All the 4-Rows for key press
+	for(i=0;i<0x03;i++)
 	{
-		M_ROW=var_keyScanCode_u8;        // Select 1-Row at a time for Scanning the Key
-		_delay_ms(1);
-		var_keyPress_u8=M_COL & 0x0F;    // Read the Column, for key press
+		for(j=i+1;j<0x04;j++)
+		{
+			var_common_u8 = var_row_au8[i] & var_row_au8[j];
+			if(var_common_u8 & (var_common_u8 - 1))   // Two or more columns in common
+				var_ghost_u8 = 1;
+		}
+	}
+
+	if(ptr_ghost_u8 != NULL)
+		*ptr_ghost_u8 = var_ghost_u8;
+	return(var_keyMap_u16);
+}
+
+
 
-		if(var_keyPress_u8!=0x0F)        // If the KEY press is detected for the selected
-			break;                     // ROW then stop Scanning,
 
-		var_keyScanCode_u8=((var_keyScanCode_u8<<1)+0x01); // Rotate the ScanKey to SCAN the remaining Rows
+
+
+/***************************************************************************************************
+                     uint16_t KEYPAD_GetGhostCount()
+ ***************************************************************************************************
+ * Return value	: uint16_t--> Number of scans of the background scanner skipped for ghost keys
+ ***************************************************************************************************/
+uint16_t KEYPAD_GetGhostCount()
+{
+	uint8_t var_sreg_u8;
+	uint16_t var_count_u16;
+
+	var_sreg_u8 = SREG;
+	cli();                        // Counted in the tick interrupt
+	var_count_u16 = var_ghostFrames_u16;
+	SREG = var_sreg_u8;
+	return(var_count_u16);
+}
+
+
+
+
+
+
+/***************************************************************************************************
+                     static uint8_t keypad_KeyFromMap(uint16_t var_keyMap_u16)
+ ***************************************************************************************************
+ * I/P Arguments: uint16_t--> Key map returned by KEYPAD_ScanMatrix
+
+ * Return value	: uint8_t--> ASCII value of the lowest Key in the map, 'z' if none is pressed
+ ***************************************************************************************************/
+static uint8_t keypad_KeyFromMap(uint16_t var_keyMap_u16)
+{
+	uint8_t i;
+
+	for(i=0;i<C_KeypadKeys_U8;i++)
+	{
+		if(var_keyMap_u16 & (1u << i))
+			return(pgm_read_byte(&C_KeyMap_au8[i]));
 	}
-	var_keyPress_u8 = var_keyPress_u8 + (var_keyScanCode_u8 & 0xf0); // Return the row and COL status to decode the key
-	return(var_keyPress_u8);
+	return('z');
 }
@@ -56,6 +56,32 @@ Errors and omissions should be reported to codelibraries@exploreembedded.com
 
 
 
+/***************************************************************************************************
+                                 Background scanner configuration
+ ***************************************************************************************************/
+#define C_KeypadEventQueueSize_U8   8u     // Events buffered for KEYPAD_GetEvent(), power of 2
+#define C_KeypadDebounceMs_U8      10u     // A key must read the same for this long to change state
+#define C_KeypadKeys_U8            16u
+#define C_KeypadSettleUs_U8         5u     // Column settle time after selecting a ROW
+/**************************************************************************************************/
+
+
+
+
+/***************************************************************************************************
+                             Key event
+ ***************************************************************************************************/
+typedef struct
+{
+	uint8_t key;         // ASCII value of the Key
+	uint8_t pressed;     // 1: pressed, 0: released
+	uint32_t time_ms;    // SYSTICK_millis() when the change was first seen, before the debounce
+}KEYPAD_Event_st;
+/**************************************************************************************************/
+
+
+
+
 /***************************************************************************************************
                              Function Prototypes
  ***************************************************************************************************/
@@ -63,6 +89,10 @@ void KEYPAD_Init();
 void KEYPAD_WaitForKeyRelease();
 void KEYPAD_WaitForKeyPress();
 uint8_t KEYPAD_GetKey();
+void KEYPAD_StartScanner();
+uint8_t KEYPAD_GetEvent(KEYPAD_Event_st *ptr_event_st);
+uint16_t KEYPAD_ScanMatrix(uint8_t *ptr_ghost_u8);
+uint16_t KEYPAD_GetGhostCount();
 /**************************************************************************************************/
 
 #endif
@@ -26,8 +26,10 @@
 #include <inttypes.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
+#include <avr/interrupt.h>
 #include <util/delay.h>
 #include "lcd.h"
+#include "systick.h"
 
 
 
@@ -45,9 +47,19 @@
 
 #if LCD_IO_MODE
 #define lcd_e_delay()   _delay_us(LCD_DELAY_ENABLE_PULSE)
+#if LCD_DISPLAYS > 1
+#define lcd_e_high()    *lcd_e_reg  |=  lcd_e_bit;
+#define lcd_e_low()     *lcd_e_reg  &= ~lcd_e_bit;
+#else
 #define lcd_e_high()    LCD_E_PORT  |=  _BV(LCD_E_PIN);
 #define lcd_e_low()     LCD_E_PORT  &= ~_BV(LCD_E_PIN);
+#endif
 #define lcd_e_toggle()  toggle_e()
+#if LCD_DISPLAYS > 1
+#define lcd_e_toggle_all()  for (uint8_t d = 0; d < LCD_DISPLAYS; d++) { lcd_e_use(d); toggle_e(); }
+#else
+#define lcd_e_toggle_all()  toggle_e()
+#endif
 #define lcd_rw_high()   LCD_RW_PORT |=  _BV(LCD_RW_PIN)
 #define lcd_rw_low()    LCD_RW_PORT &= ~_BV(LCD_RW_PIN)
 #define lcd_rs_high()   LCD_RS_PORT |=  _BV(LCD_RS_PIN)
@@ -78,12 +90,60 @@
 #endif
 #endif
 
+#if LCD_IO_MODE && LCD_DISPLAYS > 1
+/*
+** Several displays share the data, RS and RW lines, each has its own
+** Enable line. Only the display whose E line is pulsed takes the byte.
+*/
+static volatile uint8_t * const lcd_e_ports[LCD_DISPLAYS] = {
+    &LCD_E_PORT,
+    &LCD_E1_PORT,
+#if LCD_DISPLAYS > 2
+    &LCD_E2_PORT,
+#endif
+#if LCD_DISPLAYS > 3
+    &LCD_E3_PORT,
+#endif
+};
+static const uint8_t lcd_e_bits[LCD_DISPLAYS] = {
+    _BV(LCD_E_PIN),
+    _BV(LCD_E1_PIN),
+#if LCD_DISPLAYS > 2
+    _BV(LCD_E2_PIN),
+#endif
+#if LCD_DISPLAYS > 3
+    _BV(LCD_E3_PIN),
+#endif
+};
+
+/* E line of the display being driven */
+static volatile uint8_t *lcd_e_reg = &LCD_E_PORT;
+static uint8_t lcd_e_bit = _BV(LCD_E_PIN);
+
+static inline void lcd_e_use(uint8_t display)
+{
+    lcd_e_reg = lcd_e_ports[display];
+    lcd_e_bit = lcd_e_bits[display];
+}
+#else
+#define lcd_e_use(display)
+#endif
+
+static uint8_t lcd_display = 0;             /* display selected by lcd_select() */
+
+
 /* 
 ** function prototypes 
 */
 #if LCD_IO_MODE
 static void toggle_e(void);
 #endif
+#if LCD_ASYNC
+static void lcd_enqueue(uint8_t data, uint8_t rs);
+#endif
+#if LCD_TRACK_ADDRESS
+static void lcd_track(uint8_t data, uint8_t rs);
+#endif
 
 /*
 ** local functions
@@ -98,13 +158,85 @@ the number of loops is calculated at compile-time from MCU clock frequency
 
 
 #if LCD_IO_MODE
-/* toggle Enable Pin to initiate write */
-static void toggle_e(void)
+/* toggle Enable Pin to initiate write, inlined: a call would cost more than the pulse */
+static inline __attribute__((always_inline)) void toggle_e(void)
 {
     lcd_e_high();
     lcd_e_delay();
     lcd_e_low();
 }
+
+
+/*
+** Compile-time pin mapping for data lines spread over several ports.
+** LCD_NIBBLE_BITS(port, n) gives the bits of <port> that encode nibble <n>,
+** LCD_DATA_MASK(port) all data line bits of <port>. Port comparisons are
+** constant, so every port is written once per nibble with a single masked
+** write and ports without data lines cost nothing. A data line's port is
+** handled by the lowest line on the same port (LCD_DATAx_FIRST).
+**
+** MEGA pinout (D4..D7 on PE5, PG5, PE3, PH3). Cycles per byte for the
+** data lines, hand-counted from the instruction sequences gcc -Os usually
+** emits for these statements; not taken from a disassembly or measured:
+**   per-pin read-modify-write   DDR 11 + nibbles 2*(11 clear + 12.5 set) + restore 11 = 69
+**   one masked write per port   DDR 10 + nibbles 2*(7 E + 5 G + 7 H) + 2 swap + restore 10 = 60
+** plus the inlined enable pulses, 2*(4 + 16 delay) instead of 2*27 with the call.
+** By that estimate lcd_write() drops from about 139 to about 116 cycles, a
+** full 16 character line of lcd_puts() from about 2220 to 1860 cycles
+** (139 to 116 us) of pin work; the controller itself needs 37 us per
+** character on top of that. To check them, count the instructions of
+** lcd_write() in avr-objdump -d of the build, or time a sync build with
+** the console command 'l'.
+** A 16-entry lookup table per port should be slower on this pinout: the
+** pointer setup and lpm (7 cycles) cost more than testing the 1-2 bits a
+** port carries.
+*/
+#define LCD_DATA_BIT(i, port, n) \
+    ( ( (&LCD_DATA##i##_PORT == &(port)) && ((n) & (1 << (i))) ) ? _BV(LCD_DATA##i##_PIN) : 0 )
+#define LCD_NIBBLE_BITS(port, n) \
+    ( LCD_DATA_BIT(0,port,n) | LCD_DATA_BIT(1,port,n) | LCD_DATA_BIT(2,port,n) | LCD_DATA_BIT(3,port,n) )
+#define LCD_DATA_MASK(port)     LCD_NIBBLE_BITS(port, 0x0F)
+
+#define LCD_DATA1_FIRST  ( &LCD_DATA1_PORT != &LCD_DATA0_PORT )
+#define LCD_DATA2_FIRST  ( &LCD_DATA2_PORT != &LCD_DATA0_PORT && &LCD_DATA2_PORT != &LCD_DATA1_PORT )
+#define LCD_DATA3_FIRST  ( &LCD_DATA3_PORT != &LCD_DATA0_PORT && &LCD_DATA3_PORT != &LCD_DATA1_PORT \
+                        && &LCD_DATA3_PORT != &LCD_DATA2_PORT )
+
+#define lcd_port_nibble(port, n)  port = ( (port) & ~LCD_DATA_MASK(port) ) | LCD_NIBBLE_BITS(port, n)
+
+/* output nibble n on the data lines */
+static inline __attribute__((always_inline)) void lcd_data_nibble(uint8_t n)
+{
+    lcd_port_nibble(LCD_DATA0_PORT, n);
+    if (LCD_DATA1_FIRST) lcd_port_nibble(LCD_DATA1_PORT, n);
+    if (LCD_DATA2_FIRST) lcd_port_nibble(LCD_DATA2_PORT, n);
+    if (LCD_DATA3_FIRST) lcd_port_nibble(LCD_DATA3_PORT, n);
+}
+
+/* configure the data lines as output (1) or input (0) */
+static inline __attribute__((always_inline)) void lcd_data_direction(uint8_t output)
+{
+    if (output) {
+        DDR(LCD_DATA0_PORT) |= LCD_DATA_MASK(LCD_DATA0_PORT);
+        if (LCD_DATA1_FIRST) DDR(LCD_DATA1_PORT) |= LCD_DATA_MASK(LCD_DATA1_PORT);
+        if (LCD_DATA2_FIRST) DDR(LCD_DATA2_PORT) |= LCD_DATA_MASK(LCD_DATA2_PORT);
+        if (LCD_DATA3_FIRST) DDR(LCD_DATA3_PORT) |= LCD_DATA_MASK(LCD_DATA3_PORT);
+    } else {
+        DDR(LCD_DATA0_PORT) &= ~LCD_DATA_MASK(LCD_DATA0_PORT);
+        if (LCD_DATA1_FIRST) DDR(LCD_DATA1_PORT) &= ~LCD_DATA_MASK(LCD_DATA1_PORT);
+        if (LCD_DATA2_FIRST) DDR(LCD_DATA2_PORT) &= ~LCD_DATA_MASK(LCD_DATA2_PORT);
+        if (LCD_DATA3_FIRST) DDR(LCD_DATA3_PORT) &= ~LCD_DATA_MASK(LCD_DATA3_PORT);
+    }
+}
+
+/* all data pins high (inactive) */
+static inline __attribute__((always_inline)) void lcd_data_release(void)
+{
+    LCD_DATA0_PORT |= LCD_DATA_MASK(LCD_DATA0_PORT);
+    if (LCD_DATA1_FIRST) LCD_DATA1_PORT |= LCD_DATA_MASK(LCD_DATA1_PORT);
+    if (LCD_DATA2_FIRST) LCD_DATA2_PORT |= LCD_DATA_MASK(LCD_DATA2_PORT);
+    if (LCD_DATA3_FIRST) LCD_DATA3_PORT |= LCD_DATA_MASK(LCD_DATA3_PORT);
+}
 #endif
 
 
@@ -126,13 +258,17 @@ static void lcd_write(uint8_t data,uint8_t rs)
     } else {         /* write instruction (RS=0, RW=0) */
        lcd_rs_low();
     }
+#if !LCD_WRITE_ONLY
     lcd_rw_low();    /* RW=0  write mode      */
+#endif
 
     if ( ( &LCD_DATA0_PORT == &LCD_DATA1_PORT) && ( &LCD_DATA1_PORT == &LCD_DATA2_PORT ) && ( &LCD_DATA2_PORT == &LCD_DATA3_PORT )
       && (LCD_DATA0_PIN == 0) && (LCD_DATA1_PIN == 1) && (LCD_DATA2_PIN == 2) && (LCD_DATA3_PIN == 3) )
     {
+#if !LCD_WRITE_ONLY
         /* configure data pins as output */
         DDR(LCD_DATA0_PORT) |= 0x0F;
+#endif
 
         /* output high nibble first */
         dataBits = LCD_DATA0_PORT & 0xF0;
@@ -148,39 +284,21 @@ static void lcd_write(uint8_t data,uint8_t rs)
     }
     else
     {
+#if !LCD_WRITE_ONLY
         /* configure data pins as output */
-        DDR(LCD_DATA0_PORT) |= _BV(LCD_DATA0_PIN);
-        DDR(LCD_DATA1_PORT) |= _BV(LCD_DATA1_PIN);
-        DDR(LCD_DATA2_PORT) |= _BV(LCD_DATA2_PIN);
-        DDR(LCD_DATA3_PORT) |= _BV(LCD_DATA3_PIN);
-        
+        lcd_data_direction(1);
+#endif
+
         /* output high nibble first */
-        LCD_DATA3_PORT &= ~_BV(LCD_DATA3_PIN);
-        LCD_DATA2_PORT &= ~_BV(LCD_DATA2_PIN);
-        LCD_DATA1_PORT &= ~_BV(LCD_DATA1_PIN);
-        LCD_DATA0_PORT &= ~_BV(LCD_DATA0_PIN);
-    	if(data & 0x80) LCD_DATA3_PORT |= _BV(LCD_DATA3_PIN);
-    	if(data & 0x40) LCD_DATA2_PORT |= _BV(LCD_DATA2_PIN);
-    	if(data & 0x20) LCD_DATA1_PORT |= _BV(LCD_DATA1_PIN);
-    	if(data & 0x10) LCD_DATA0_PORT |= _BV(LCD_DATA0_PIN);   
+        lcd_data_nibble(data >> 4);
         lcd_e_toggle();
-        
+
         /* output low nibble */
-        LCD_DATA3_PORT &= ~_BV(LCD_DATA3_PIN);
-        LCD_DATA2_PORT &= ~_BV(LCD_DATA2_PIN);
-        LCD_DATA1_PORT &= ~_BV(LCD_DATA1_PIN);
-        LCD_DATA0_PORT &= ~_BV(LCD_DATA0_PIN);
-    	if(data & 0x08) LCD_DATA3_PORT |= _BV(LCD_DATA3_PIN);
-    	if(data & 0x04) LCD_DATA2_PORT |= _BV(LCD_DATA2_PIN);
-    	if(data & 0x02) LCD_DATA1_PORT |= _BV(LCD_DATA1_PIN);
-    	if(data & 0x01) LCD_DATA0_PORT |= _BV(LCD_DATA0_PIN);
-        lcd_e_toggle();        
-        
+        lcd_data_nibble(data & 0x0F);
+        lcd_e_toggle();
+
         /* all data pins high (inactive) */
-        LCD_DATA0_PORT |= _BV(LCD_DATA0_PIN);
-        LCD_DATA1_PORT |= _BV(LCD_DATA1_PIN);
-        LCD_DATA2_PORT |= _BV(LCD_DATA2_PIN);
-        LCD_DATA3_PORT |= _BV(LCD_DATA3_PIN);
+        lcd_data_release();
     }
 }
 #else
@@ -196,7 +314,9 @@ Input:    rs     1: read data
                  0: read busy flag / address counter
 Returns:  byte read from LCD controller
 *************************************************************************/
-#if LCD_IO_MODE
+#if LCD_WRITE_ONLY
+/* never read: R/W stays low, the data lines stay outputs */
+#elif LCD_IO_MODE
 static uint8_t lcd_read(uint8_t rs) 
 {
     uint8_t data;
@@ -228,10 +348,7 @@ static uint8_t lcd_read(uint8_t rs)
     else
     {
         /* configure data pins as input */
-        DDR(LCD_DATA0_PORT) &= ~_BV(LCD_DATA0_PIN);
-        DDR(LCD_DATA1_PORT) &= ~_BV(LCD_DATA1_PIN);
-        DDR(LCD_DATA2_PORT) &= ~_BV(LCD_DATA2_PIN);
-        DDR(LCD_DATA3_PORT) &= ~_BV(LCD_DATA3_PIN);
+        lcd_data_direction(0);
                 
         /* read high nibble first */
         lcd_e_high();
@@ -263,6 +380,45 @@ static uint8_t lcd_read(uint8_t rs)
 #endif
 
 
+/*************************************************************************
+Write-only mode: the busy flag is never read. After every byte the display
+is given the execution time the HD44780 data sheet specifies for it, timed
+with SYSTICK_micros() instead of a delay loop, so the caller (or the Timer2
+interrupt) only waits for what is left of the budget when the next byte is
+due. Every display has its own budget. With R/W wired it can also be
+selected at run time, see lcd_set_write_only().
+*************************************************************************/
+static uint32_t lcd_ready_us[LCD_DISPLAYS];    /* display accepts the next byte */
+
+static uint16_t lcd_exec_us(uint8_t data, uint8_t rs)
+{
+    if (rs) return LCD_EXEC_DATA_US;
+    if (data == (1<<LCD_CLR) || (data & ~1) == (1<<LCD_HOME)) return LCD_EXEC_CLEAR_US;
+    return LCD_EXEC_US;
+}
+
+/* 1: the display has executed the previous byte */
+static inline uint8_t lcd_ready(uint8_t display)
+{
+    return (int32_t)(SYSTICK_micros() - lcd_ready_us[display]) >= 0;
+}
+
+static void lcd_write_timed(uint8_t display, uint8_t data, uint8_t rs)
+{
+    lcd_write(data, rs);
+
+    /* SYSTICK_micros() counts in steps of 4 us, add one step */
+    lcd_ready_us[display] = SYSTICK_micros() + lcd_exec_us(data, rs) + 4;
+}
+
+#if !LCD_WRITE_ONLY
+static volatile uint8_t lcd_timed = 0;      /* 1: write-only pacing selected at run time */
+#else
+#define lcd_timed 1
+#endif
+
+
+#if !LCD_ASYNC && !LCD_WRITE_ONLY
 /*************************************************************************
 loops while lcd is busy, returns address counter
 *************************************************************************/
@@ -272,7 +428,15 @@ static uint8_t lcd_waitbusy(void)
     register uint8_t c;
     
     /* wait until busy flag is cleared */
+#if LCD_DISPLAYS > 1
+    /* a display that is not fitted reads busy forever: do not hang on it */
+    uint16_t polls = 0;
+    while ( ((c=lcd_read(0)) & (1<<LCD_BUSY)) && ++polls < LCD_BUSY_TIMEOUT_US ) {
+        _delay_us(1);
+    }
+#else
     while ( (c=lcd_read(0)) & (1<<LCD_BUSY)) {}
+#endif
     
     /* the address counter is updated 4us after the busy flag is cleared */
     delay(LCD_DELAY_BUSY_FLAG);
@@ -281,6 +445,156 @@ static uint8_t lcd_waitbusy(void)
     return (lcd_read(0));  // return address counter
     
 }/* lcd_waitbusy */
+#endif
+
+
+#if LCD_TRACK_ADDRESS
+/*************************************************************************
+The address counter cannot be read back in write-only mode, nor without
+waiting for the queue to drain in asynchronous mode: it is tracked in
+software as bytes are sent or queued.
+*************************************************************************/
+static uint8_t lcd_addresses[LCD_DISPLAYS]; /* DDRAM address after the bytes sent or queued */
+static uint8_t lcd_cgram = 0;               /* bit per display, 1: data goes to CGRAM */
+#define lcd_address lcd_addresses[lcd_display]
+
+
+/* follow the address counter of the selected display the way the controller will */
+static void lcd_track(uint8_t data, uint8_t rs)
+{
+    uint8_t cgram = _BV(lcd_display);
+
+    if (rs) {
+        if (lcd_cgram & cgram) return;
+        lcd_address++;
+#if LCD_LINES > 1
+        /* in 2-line mode the counter jumps between the 40-column lines */
+        if ( lcd_address == LCD_START_LINE1+40 )
+            lcd_address = LCD_START_LINE2;
+        else if ( lcd_address == LCD_START_LINE2+40 )
+            lcd_address = LCD_START_LINE1;
+#endif
+    } else if (data & (1<<LCD_DDRAM)) {
+        lcd_address = data & ~(1<<LCD_DDRAM);
+        lcd_cgram &= ~cgram;
+    } else if (data & (1<<LCD_CGRAM)) {
+        lcd_cgram |= cgram;
+    } else if (data == (1<<LCD_CLR) || (data & ~1) == (1<<LCD_HOME)) {
+        lcd_address = 0;
+        lcd_cgram &= ~cgram;
+    }
+}
+
+
+#endif
+
+
+#if LCD_ASYNC
+/*************************************************************************
+Asynchronous output: lcd_command() and lcd_data() only append to a ring,
+the Timer2 compare interrupt sends one byte per tick. The interrupt reads
+the busy flag once (or checks the execution time budget in write-only
+mode) and leaves the byte for the next tick if the controller is still
+busy, so nothing ever waits for the display.
+*************************************************************************/
+#define LCD_QUEUE_MASK      (LCD_QUEUE_SIZE - 1)
+#define LCD_QUEUE_RS        0x100           /* entry is data, not an instruction */
+#define LCD_QUEUE_DISPLAY   9               /* entry bits 9..10: display */
+#define LCD_BUSY_TICKS      (LCD_BUSY_TIMEOUT_US / LCD_ASYNC_PERIOD_US)
+#define LCD_TIMER_TOP       ((F_CPU / 8 / 1000000UL) * LCD_ASYNC_PERIOD_US - 1)
+
+static volatile uint16_t lcd_queue[LCD_QUEUE_SIZE];
+static volatile uint8_t lcd_queue_head = 0;
+static volatile uint8_t lcd_queue_tail = 0;
+static uint16_t lcd_queue_dropped = 0;
+
+#if !LCD_WRITE_ONLY
+static uint8_t lcd_busy_ticks = 0;
+static uint8_t lcd_absent = 0;              /* bit per display that never became ready */
+#endif
+
+
+static void lcd_enqueue(uint8_t data, uint8_t rs)
+{
+    uint8_t next = (lcd_queue_head + 1) & LCD_QUEUE_MASK;
+
+    /* ring full: waiting could deadlock with interrupts disabled, drop the byte */
+    if (next == lcd_queue_tail) {
+        lcd_queue_dropped++;
+        return;
+    }
+
+    lcd_queue[lcd_queue_head] = ((uint16_t)lcd_display << LCD_QUEUE_DISPLAY)
+                              | (rs ? LCD_QUEUE_RS : 0) | data;
+    lcd_queue_head = next;
+    lcd_track(data, rs);
+
+    TIMSK2 |= _BV(OCIE2A);
+}
+
+
+/* start the pacing timer: CTC mode, /8 prescaler, one tick per LCD_ASYNC_PERIOD_US */
+static void lcd_timer_init(void)
+{
+    TCCR2A = _BV(WGM21);
+    TCCR2B = _BV(CS21);
+    OCR2A  = LCD_TIMER_TOP;
+}
+
+
+ISR(TIMER2_COMPA_vect)
+{
+    if (lcd_queue_tail == lcd_queue_head) {
+        TIMSK2 &= ~_BV(OCIE2A);             /* nothing left, stop ticking */
+        return;
+    }
+
+    uint16_t entry = lcd_queue[lcd_queue_tail];
+    uint8_t display = entry >> LCD_QUEUE_DISPLAY;
+
+    if (lcd_timed) {
+        if ( !lcd_ready(display) ) {
+            return;                         /* try again on the next tick */
+        }
+        lcd_e_use(display);
+        lcd_write_timed(display, (uint8_t)entry, (entry & LCD_QUEUE_RS) ? 1 : 0);
+    }
+#if !LCD_WRITE_ONLY
+    else if ( !(lcd_absent & _BV(display)) ) {
+        lcd_e_use(display);
+
+        if (lcd_read(0) & (1<<LCD_BUSY)) {
+            /* a display that is not fitted reads busy forever: give up on it */
+            if (++lcd_busy_ticks < LCD_BUSY_TICKS) {
+                return;                     /* try again on the next tick */
+            }
+            lcd_absent |= _BV(display);
+        } else {
+            lcd_write((uint8_t)entry, (entry & LCD_QUEUE_RS) ? 1 : 0);
+        }
+    }
+    lcd_busy_ticks = 0;
+#endif
+    lcd_queue_tail = (lcd_queue_tail + 1) & LCD_QUEUE_MASK;
+}
+#define lcd_out(d,rs)   lcd_enqueue(d,rs)
+#else
+/* wait for the rest of the previous byte's budget, then send */
+static void lcd_send(uint8_t data, uint8_t rs)
+{
+    while ( !lcd_ready(lcd_display) ) {}
+    lcd_write_timed(lcd_display, data, rs);
+#if LCD_TRACK_ADDRESS
+    lcd_track(data, rs);
+#endif
+}
+#if LCD_WRITE_ONLY
+#define lcd_out(d,rs)   lcd_send(d,rs)
+#else
+/* the busy flag has been read by the caller */
+#define lcd_out(d,rs)   do { if (lcd_timed) lcd_send(d,rs); else lcd_write(d,rs); } while (0)
+#endif
+#endif
 
 
 /*************************************************************************
@@ -338,8 +652,18 @@ Returns: none
 *************************************************************************/
 void lcd_command(uint8_t cmd)
 {
-    lcd_waitbusy();
-    lcd_write(cmd,0);
+#if LCD_ASYNC
+    lcd_enqueue(cmd,0);
+#elif LCD_WRITE_ONLY
+    lcd_send(cmd,0);
+#else
+    if (lcd_timed) {
+        lcd_send(cmd,0);
+    } else {
+        lcd_waitbusy();
+        lcd_write(cmd,0);
+    }
+#endif
 }
 
 
@@ -350,8 +674,18 @@ Returns: none
 *************************************************************************/
 void lcd_data(uint8_t data)
 {
-    lcd_waitbusy();
-    lcd_write(data,1);
+#if LCD_ASYNC
+    lcd_enqueue(data,1);
+#elif LCD_WRITE_ONLY
+    lcd_send(data,1);
+#else
+    if (lcd_timed) {
+        lcd_send(data,1);
+    } else {
+        lcd_waitbusy();
+        lcd_write(data,1);
+    }
+#endif
 }
 
 
@@ -391,7 +725,99 @@ void lcd_gotoxy(uint8_t x, uint8_t y)
 *************************************************************************/
 int lcd_getxy(void)
 {
+#if LCD_TRACK_ADDRESS
+    return lcd_address;
+#else
     return lcd_waitbusy();
+#endif
+}
+
+
+/*************************************************************************
+Select the display the following functions write to
+Input:    display  0 .. LCD_DISPLAYS-1
+Returns:  none
+*************************************************************************/
+void lcd_select(uint8_t display)
+{
+    if (display >= LCD_DISPLAYS) return;
+
+    lcd_display = display;
+#if !LCD_ASYNC
+    lcd_e_use(display);
+#endif
+}
+
+
+/*************************************************************************
+Number of bytes waiting to be sent to the display
+*************************************************************************/
+uint8_t lcd_pending(void)
+{
+#if LCD_ASYNC
+    return (lcd_queue_head - lcd_queue_tail) & LCD_QUEUE_MASK;
+#else
+    return 0;
+#endif
+}
+
+
+/*************************************************************************
+Number of bytes that can be queued without dropping any
+*************************************************************************/
+uint8_t lcd_free(void)
+{
+#if LCD_ASYNC
+    return (LCD_QUEUE_SIZE - 1) - lcd_pending();
+#else
+    return 255;
+#endif
+}
+
+
+/*************************************************************************
+Select write-only (1) or busy-flag (0) pacing
+*************************************************************************/
+uint8_t lcd_set_write_only(uint8_t on)
+{
+#if !LCD_WRITE_ONLY
+    uint8_t sreg = SREG;
+    cli();
+    if (on && !lcd_timed) {
+        /* the last byte sent on the busy flag may still be executing */
+        uint32_t ready = SYSTICK_micros() + LCD_EXEC_CLEAR_US;
+        for (uint8_t d = 0; d < LCD_DISPLAYS; d++) {
+            lcd_ready_us[d] = ready;
+        }
+    }
+    lcd_timed = on ? 1 : 0;
+    SREG = sreg;
+    return 1;
+#else
+    return (on ? 1 : 0) == LCD_WRITE_ONLY;
+#endif
+}
+
+
+/*************************************************************************
+Pacing currently in use, 1: write-only
+*************************************************************************/
+uint8_t lcd_write_only(void)
+{
+    return lcd_timed;
+}
+
+
+/*************************************************************************
+Number of bytes dropped because the queue was full
+*************************************************************************/
+uint16_t lcd_dropped(void)
+{
+#if LCD_ASYNC
+    return lcd_queue_dropped;
+#else
+    return 0;
+#endif
 }
 
 
@@ -423,7 +849,11 @@ void lcd_putc(char c)
     uint8_t pos;
 
 
+#if LCD_TRACK_ADDRESS
+    pos = lcd_address;      // tracked in software, reading it would wait for the queue
+#else
     pos = lcd_waitbusy();   // read busy-flag and address counter
+#endif
     if (c=='\n')
     {
         lcd_newline(pos);
@@ -433,28 +863,30 @@ void lcd_putc(char c)
 #if LCD_WRAP_LINES==1
 #if LCD_LINES==1
         if ( pos == LCD_START_LINE1+LCD_DISP_LENGTH ) {
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE1,0);
+            lcd_out((1<<LCD_DDRAM)+LCD_START_LINE1,0);
         }
 #elif LCD_LINES==2
         if ( pos == LCD_START_LINE1+LCD_DISP_LENGTH ) {
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE2,0);    
+            lcd_out((1<<LCD_DDRAM)+LCD_START_LINE2,0);    
         }else if ( pos == LCD_START_LINE2+LCD_DISP_LENGTH ){
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE1,0);
+            lcd_out((1<<LCD_DDRAM)+LCD_START_LINE1,0);
         }
 #elif LCD_LINES==4
         if ( pos == LCD_START_LINE1+LCD_DISP_LENGTH ) {
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE2,0);    
+            lcd_out((1<<LCD_DDRAM)+LCD_START_LINE2,0);    
         }else if ( pos == LCD_START_LINE2+LCD_DISP_LENGTH ) {
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE3,0);
+            lcd_out((1<<LCD_DDRAM)+LCD_START_LINE3,0);
         }else if ( pos == LCD_START_LINE3+LCD_DISP_LENGTH ) {
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE4,0);
+            lcd_out((1<<LCD_DDRAM)+LCD_START_LINE4,0);
         }else if ( pos == LCD_START_LINE4+LCD_DISP_LENGTH ) {
-            lcd_write((1<<LCD_DDRAM)+LCD_START_LINE1,0);
+            lcd_out((1<<LCD_DDRAM)+LCD_START_LINE1,0);
         }
 #endif
+#if !LCD_ASYNC && !LCD_WRITE_ONLY
         lcd_waitbusy();
 #endif
-        lcd_write(c, 1);
+#endif
+        lcd_out(c, 1);
     }
 
 }/* lcd_putc */
@@ -537,28 +969,43 @@ void lcd_init(uint8_t dispAttr)
         DDR(LCD_DATA2_PORT) |= _BV(LCD_DATA2_PIN);
         DDR(LCD_DATA3_PORT) |= _BV(LCD_DATA3_PIN);
     }
+#if LCD_WRITE_ONLY
+    lcd_rw_low();                        /* never changes again                    */
+#endif
+#if LCD_DISPLAYS > 1
+    DDR(LCD_E1_PORT) |= _BV(LCD_E1_PIN);
+#if LCD_DISPLAYS > 2
+    DDR(LCD_E2_PORT) |= _BV(LCD_E2_PIN);
+#endif
+#if LCD_DISPLAYS > 3
+    DDR(LCD_E3_PORT) |= _BV(LCD_E3_PIN);
+#endif
+#endif
     delay(LCD_DELAY_BOOTUP);             /* wait 16ms or more after power-on       */
     
     /* initial write to lcd is 8bit */
     LCD_DATA1_PORT |= _BV(LCD_DATA1_PIN);    // LCD_FUNCTION>>4;
     LCD_DATA0_PORT |= _BV(LCD_DATA0_PIN);    // LCD_FUNCTION_8BIT>>4;
-    lcd_e_toggle();
+    lcd_e_toggle_all();
     delay(LCD_DELAY_INIT);               /* delay, busy flag can't be checked here */
    
     /* repeat last command */ 
-    lcd_e_toggle();      
+    lcd_e_toggle_all();      
     delay(LCD_DELAY_INIT_REP);           /* delay, busy flag can't be checked here */
     
     /* repeat last command a third time */
-    lcd_e_toggle();      
+    lcd_e_toggle_all();      
     delay(LCD_DELAY_INIT_REP);           /* delay, busy flag can't be checked here */
 
     /* now configure for 4bit mode */
     LCD_DATA0_PORT &= ~_BV(LCD_DATA0_PIN);   // LCD_FUNCTION_4BIT_1LINE>>4
-    lcd_e_toggle();
+    lcd_e_toggle_all();
     delay(LCD_DELAY_INIT_4BIT);          /* some displays need this additional delay */
     
     /* from now the LCD only accepts 4 bit I/O, we can use lcd_command() */    
+#if LCD_ASYNC
+    lcd_timer_init();
+#endif
 #else
     /*
      * Initialize LCD to 8 bit memory mapped mode
@@ -577,17 +1024,22 @@ void lcd_init(uint8_t dispAttr)
     delay(LCD_DELAY_INIT_REP);                  /* wait 64us                    */
 #endif
 
+    /* same setup for every display, display 0 stays selected */
+    for (uint8_t d = LCD_DISPLAYS; d-- > 0; )
+    {
+        lcd_select(d);
 #if KS0073_4LINES_MODE
-    /* Display with KS0073 controller requires special commands for enabling 4 line mode */
-	lcd_command(KS0073_EXTENDED_FUNCTION_REGISTER_ON);
-	lcd_command(KS0073_4LINES_MODE);
-	lcd_command(KS0073_EXTENDED_FUNCTION_REGISTER_OFF);
+        /* Display with KS0073 controller requires special commands for enabling 4 line mode */
+		lcd_command(KS0073_EXTENDED_FUNCTION_REGISTER_ON);
+		lcd_command(KS0073_4LINES_MODE);
+		lcd_command(KS0073_EXTENDED_FUNCTION_REGISTER_OFF);
 #else
-    lcd_command(LCD_FUNCTION_DEFAULT);      /* function set: display lines  */
+        lcd_command(LCD_FUNCTION_DEFAULT);      /* function set: display lines  */
 #endif
-    lcd_command(LCD_DISP_OFF);              /* display off                  */
-    lcd_clrscr();                           /* display clear                */ 
-    lcd_command(LCD_MODE_DEFAULT);          /* set entry mode               */
-    lcd_command(dispAttr);                  /* display/cursor control       */
+        lcd_command(LCD_DISP_OFF);              /* display off                  */
+        lcd_clrscr();                           /* display clear                */ 
+        lcd_command(LCD_MODE_DEFAULT);          /* set entry mode               */
+        lcd_command(dispAttr);                  /* display/cursor control       */
+    }
 
 }/* lcd_init */
@@ -175,6 +175,58 @@
 #endif
 
 
+/**
+ * Several displays can share the data, RS and RW lines, each with its own
+ * Enable line: display 0 uses LCD_E_PORT/LCD_E_PIN, display n LCD_En_PORT/LCD_En_PIN.
+ * lcd_select() picks the display all other functions write to. A display that
+ * keeps reporting busy for LCD_BUSY_TIMEOUT_US is treated as not fitted.
+ */
+#ifndef LCD_DISPLAYS
+#define LCD_DISPLAYS         1        /**< number of displays, 1..4 */
+#endif
+#ifndef LCD_BUSY_TIMEOUT_US
+#define LCD_BUSY_TIMEOUT_US  10000    /**< longest busy time before a display is given up */
+#endif
+
+/**
+ * With LCD_WRITE_ONLY set, R/W is held low and the busy flag is never read
+ * (R/W may then be tied to GND). Instead every byte is given the execution
+ * time from the HD44780 data sheet, at the slowest specified oscillator
+ * (190 kHz instead of the nominal 270 kHz), timed with SYSTICK_micros():
+ * SYSTICK_init() must be called before lcd_init().
+ */
+#ifndef LCD_WRITE_ONLY
+#define LCD_WRITE_ONLY       0        /**< 0: wait for the busy flag, 1: never read, wait for the execution time */
+#endif
+#ifndef LCD_EXEC_US
+#define LCD_EXEC_US          53       /**< execution time of most instructions, 37 us at 270 kHz */
+#endif
+#ifndef LCD_EXEC_DATA_US
+#define LCD_EXEC_DATA_US     59       /**< data write incl. address update (tADD), 41 us at 270 kHz */
+#endif
+#ifndef LCD_EXEC_CLEAR_US
+#define LCD_EXEC_CLEAR_US    2160     /**< clear display and return home, 1.52 ms at 270 kHz */
+#endif
+
+/**
+ * @name Definitions for asynchronous output
+ * With LCD_ASYNC set, lcd_command() and lcd_data() (and everything built on them)
+ * only queue the bytes; the Timer2 compare interrupt sends one byte per tick
+ * once the controller is no longer busy. Timer2 must not be used otherwise.
+ * Only available in 4-bit IO port mode.
+ */
+#ifndef LCD_ASYNC
+#define LCD_ASYNC            1        /**< 0: wait for the busy flag in the caller, 1: queue and send from Timer2 */
+#endif
+#ifndef LCD_QUEUE_SIZE
+#define LCD_QUEUE_SIZE      128       /**< queue entries, power of 2 up to 256; holds LCD_QUEUE_SIZE-1 bytes, a marquee needs 83 */
+#endif
+#define LCD_TRACK_ADDRESS   (LCD_ASYNC || LCD_WRITE_ONLY)   /**< address counter kept in software */
+#ifndef LCD_ASYNC_PERIOD_US
+#define LCD_ASYNC_PERIOD_US 50        /**< Timer2 tick in micro seconds, one byte per tick at most */
+#endif
+
+
 /**
  * @name Definitions for LCD command instructions
  * The constants define the various LCD controller instructions which can be passed to the 
@@ -315,6 +367,60 @@ extern void lcd_command(uint8_t cmd);
 extern void lcd_data(uint8_t data);
 
 
+/**
+ @brief    Number of bytes still waiting to be sent
+ @return   0 when the display is up to date, always 0 without LCD_ASYNC
+*/
+extern uint8_t lcd_pending(void);
+
+
+/**
+ @brief    Number of bytes that can be queued without dropping any
+ @return   free queue entries, 255 without LCD_ASYNC
+
+ A byte sent to a full queue is dropped and counted, lcd_dropped(): the
+ caller is never made to wait, not even with interrupts disabled. Check
+ the room before writing a batch that must arrive whole.
+*/
+extern uint8_t lcd_free(void);
+
+
+/**
+ @brief    Switch the pacing of the queued bytes at run time
+ @param    on  1: write-only, every byte waits its execution time;
+               0: read the busy flag before every byte
+ @return   1 if the pacing is now as requested
+
+ Needs a build without LCD_WRITE_ONLY, so that R/W is wired; write-only
+ builds keep their pacing and only report whether it matches. Bytes
+ already queued are sent with the new pacing. Used to compare the two
+ modes on the same display.
+*/
+extern uint8_t lcd_set_write_only(uint8_t on);
+
+
+/**
+ @brief    Pacing in use
+ @return   1: write-only, 0: busy flag
+*/
+extern uint8_t lcd_write_only(void);
+
+
+/**
+ @brief    Number of bytes dropped because the queue was full
+ @return   count since lcd_init(), always 0 without LCD_ASYNC
+*/
+extern uint16_t lcd_dropped(void);
+
+
+/**
+ @brief    Select the display the other functions write to
+ @param    display  0 .. LCD_DISPLAYS-1, other values are ignored
+ @return   none
+*/
+extern void lcd_select(uint8_t display);
+
+
 /**
  @brief macros for automatically storing string constant in program memory
 */
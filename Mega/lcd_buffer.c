@@ -0,0 +1,181 @@
+/*
+ * lcd_buffer.c
+ *
+ * Shadow framebuffer on top of the HD44780 driver.
+ *
+ * Two copies of every display are kept: the framebuffer the application
+ * draws into and the content of the glass as last sent. A flush walks
+ * both, sets the DDRAM address only where the run of changed characters
+ * is broken and relies on the controller's address auto-increment
+ * otherwise. In steady state a flush costs one compare per character and
+ * no bus traffic; a clear alone takes the controller 1.52 ms.
+ *
+ * Drawing marks the display dirty, so a flush skips the displays that did
+ * not change without comparing them.
+ */
+
+#include "lcd_buffer.h"
+
+#include <avr/pgmspace.h>
+
+// Not drawn by the application (CGRAM glyphs use the 0x08-0x0F aliases),
+// forces the cell to be rewritten
+#define CELL_UNKNOWN    0x00
+
+typedef struct {
+    char frame[LCDBUF_LINES][LCDBUF_COLS];
+    char glass[LCDBUF_LINES][LCDBUF_COLS];
+    uint8_t cursor_x;
+    uint8_t cursor_y;
+} LcdBuffer;
+
+static LcdBuffer buffers[LCDBUF_DISPLAYS];
+static LcdBuffer *buf = &buffers[0];
+static uint8_t selected = 0;
+
+static uint8_t dirty = 0;       // bit per display: frame differs from glass
+static uint8_t held = 0;        // bit per display: not flushed
+static uint8_t next_flush = 0;  // round robin position
+
+void lcdbuf_init(void) {
+    for (uint8_t d = 0; d < LCDBUF_DISPLAYS; d++) {
+        LcdBuffer *b = &buffers[d];
+        for (uint8_t y = 0; y < LCDBUF_LINES; y++) {
+            for (uint8_t x = 0; x < LCDBUF_COLS; x++) {
+                b->frame[y][x] = ' ';
+                b->glass[y][x] = ' ';
+            }
+        }
+        b->cursor_x = 0;
+        b->cursor_y = 0;
+    }
+    dirty = 0;
+    held = 0;
+    lcdbuf_select(0);
+}
+
+void lcdbuf_select(uint8_t display) {
+    if (display >= LCDBUF_DISPLAYS) return;
+
+    selected = display;
+    buf = &buffers[display];
+}
+
+uint8_t lcdbuf_selected(void) {
+    return selected;
+}
+
+void lcdbuf_hold(uint8_t display, uint8_t hold) {
+    if (hold) {
+        held |= (1 << display);
+    } else {
+        held &= ~(1 << display);
+    }
+}
+
+void lcdbuf_clear(void) {
+    for (uint8_t y = 0; y < LCDBUF_LINES; y++) {
+        for (uint8_t x = 0; x < LCDBUF_COLS; x++) {
+            buf->frame[y][x] = ' ';
+        }
+    }
+    buf->cursor_x = 0;
+    buf->cursor_y = 0;
+    dirty |= (1 << selected);
+}
+
+void lcdbuf_gotoxy(uint8_t x, uint8_t y) {
+    buf->cursor_x = x;
+    buf->cursor_y = y;
+}
+
+void lcdbuf_putc(char c) {
+    if (c == '\n') {
+        buf->cursor_x = 0;
+        buf->cursor_y = (buf->cursor_y + 1) % LCDBUF_LINES;
+        return;
+    }
+    if (buf->cursor_x < LCDBUF_COLS && buf->cursor_y < LCDBUF_LINES) {
+        buf->frame[buf->cursor_y][buf->cursor_x] = c;
+        dirty |= (1 << selected);
+    }
+    buf->cursor_x++;
+}
+
+void lcdbuf_puts(const char *s) {
+    char c;
+    while ((c = *s++)) {
+        lcdbuf_putc(c);
+    }
+}
+
+void lcdbuf_puts_p(const char *progmem_s) {
+    char c;
+    while ((c = pgm_read_byte(progmem_s++))) {
+        lcdbuf_putc(c);
+    }
+}
+
+uint8_t lcdbuf_contains(char c) {
+    for (uint8_t y = 0; y < LCDBUF_LINES; y++) {
+        for (uint8_t x = 0; x < LCDBUF_COLS; x++) {
+            if (buf->frame[y][x] == c) return 1;
+        }
+    }
+    return 0;
+}
+
+void lcdbuf_invalidate(void) {
+    for (uint8_t y = 0; y < LCDBUF_LINES; y++) {
+        for (uint8_t x = 0; x < LCDBUF_COLS; x++) {
+            buf->glass[y][x] = CELL_UNKNOWN;
+        }
+    }
+    dirty |= (1 << selected);
+}
+
+static uint8_t flush_display(uint8_t display) {
+    LcdBuffer *b = &buffers[display];
+    uint8_t sent = 0;
+
+    lcd_select(display);
+
+    for (uint8_t y = 0; y < LCDBUF_LINES; y++) {
+        // Column the controller's address counter points at on this line
+        uint8_t address = LCDBUF_COLS;
+
+        for (uint8_t x = 0; x < LCDBUF_COLS; x++) {
+            char c = b->frame[y][x];
+            if (c == b->glass[y][x]) continue;
+
+            if (address != x) {
+                lcd_gotoxy(x, y);
+                sent++;
+            }
+            lcd_data(c);
+            sent++;
+
+            b->glass[y][x] = c;
+            address = x + 1;
+        }
+    }
+
+    return sent;
+}
+
+uint8_t lcdbuf_flush(void) {
+    // A display may need a cursor move per character, wait for the room
+    if (lcd_free() < LCDBUF_LINES * LCDBUF_COLS * 2) return 0;
+
+    for (uint8_t i = 0; i < LCDBUF_DISPLAYS; i++) {
+        uint8_t d = next_flush;
+        next_flush = (next_flush + 1) % LCDBUF_DISPLAYS;
+
+        uint8_t bit = 1 << d;
+        if ((dirty & bit) && !(held & bit)) {
+            dirty &= ~bit;
+            return flush_display(d);
+        }
+    }
+    return 0;
+}
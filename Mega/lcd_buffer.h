@@ -0,0 +1,110 @@
+/*
+ * lcd_buffer.h
+ *
+ * Shadow framebuffer on top of the HD44780 driver. Text is drawn into a
+ * RAM copy of the display; lcdbuf_flush() compares it with what is on the
+ * glass and sends cursor moves and data only for the characters that
+ * changed. Nothing is sent while the content stays the same, and the
+ * display is never cleared, so updates do not flicker.
+ *
+ * With several displays (LCD_DISPLAYS) each has its own framebuffer,
+ * cursor and dirty flag. Drawing goes to the display picked with
+ * lcdbuf_select(); a flush serves one changed display at a time, in turn.
+ */
+
+#ifndef LCD_BUFFER_H
+#define LCD_BUFFER_H
+
+#include <stdint.h>
+
+#include "lcd.h"
+
+#define LCDBUF_LINES    LCD_LINES
+#define LCDBUF_COLS     LCD_DISP_LENGTH
+#define LCDBUF_DISPLAYS LCD_DISPLAYS
+
+/**
+ * @brief Blank the framebuffers and mark the glass as blank
+ *
+ * Call after lcd_init(), which leaves the displays cleared. Selects display 0.
+ */
+void lcdbuf_init(void);
+
+/**
+ * @brief Select the framebuffer the other functions draw into
+ * @param display 0 .. LCDBUF_DISPLAYS-1, other values are ignored
+ */
+void lcdbuf_select(uint8_t display);
+
+/**
+ * @brief Get the selected framebuffer
+ * @return Display number
+ */
+uint8_t lcdbuf_selected(void);
+
+/**
+ * @brief Stop flushing a display while something else drives it
+ * @param display Display number
+ * @param hold 1 to hold, 0 to resume flushing
+ */
+void lcdbuf_hold(uint8_t display, uint8_t hold);
+
+/**
+ * @brief Fill the framebuffer with spaces and move the cursor home
+ *
+ * Replaces lcd_clrscr(): the glass is only updated on the next flush.
+ */
+void lcdbuf_clear(void);
+
+/**
+ * @brief Move the framebuffer cursor
+ * @param x Column (0: left most position)
+ * @param y Line (0: first line)
+ */
+void lcdbuf_gotoxy(uint8_t x, uint8_t y);
+
+/**
+ * @brief Draw a character at the cursor and advance it
+ * @param c Character; '\n' moves to the start of the next line
+ *
+ * Characters past the end of a line are dropped.
+ */
+void lcdbuf_putc(char c);
+
+/**
+ * @brief Draw a string at the cursor
+ * @param s String
+ */
+void lcdbuf_puts(const char *s);
+
+/**
+ * @brief Draw a string from program memory at the cursor
+ * @param progmem_s String in PROGMEM
+ */
+void lcdbuf_puts_p(const char *progmem_s);
+
+/**
+ * @brief Check whether a character is anywhere in the framebuffer
+ * @param c Character code
+ * @return 1 if found, 0 otherwise
+ */
+uint8_t lcdbuf_contains(char c);
+
+/**
+ * @brief Forget what is on the glass so the next flush rewrites everything
+ *
+ * Use after writing to the display directly with the lcd_* functions.
+ */
+void lcdbuf_invalidate(void);
+
+/**
+ * @brief Send the changed characters of the next changed display
+ * @return Number of bytes (commands and data) sent to the controller
+ *
+ * Serves one display per call, round robin, so one busy display cannot
+ * starve the others and a call never queues more than one screen. Does
+ * nothing while the driver queue has no room for a whole screen.
+ */
+uint8_t lcdbuf_flush(void);
+
+#endif
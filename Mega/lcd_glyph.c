@@ -0,0 +1,144 @@
+/*
+ * lcd_glyph.c
+ *
+ * Custom character manager for the HD44780: on-demand CGRAM upload with
+ * least-recently-used slot replacement. Every display has its own CGRAM,
+ * so the slots are tracked per display.
+ */
+
+#include "lcd_glyph.h"
+#include "lcd_buffer.h"
+#include "lcd.h"
+
+#include <avr/pgmspace.h>
+
+#define GLYPH_ROWS      8
+#define GLYPH_CODE(s)   (0x08 + (s))    // framebuffer code of CGRAM slot s
+#define SLOT_FREE       0xFF
+#define CHAR_BLOCK      0xFF            // all pixels on, in the character ROM
+#define UPLOAD_BYTES    (1 + GLYPH_ROWS) // CGRAM address and the rows
+
+static const uint8_t glyphs[GLYPH_COUNT][GLYPH_ROWS] PROGMEM = {
+    [GLYPH_ARROW_UP]   = { 0x04, 0x0E, 0x15, 0x04, 0x04, 0x04, 0x04, 0x00 },
+    [GLYPH_ARROW_DOWN] = { 0x04, 0x04, 0x04, 0x04, 0x15, 0x0E, 0x04, 0x00 },
+    [GLYPH_BAR_1]      = { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 },
+    [GLYPH_BAR_2]      = { 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18 },
+    [GLYPH_BAR_3]      = { 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C },
+    [GLYPH_BAR_4]      = { 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E },
+};
+
+// Character ROM stand-ins, drawn while the LCD queue has no room for an upload
+static const char fallbacks[GLYPH_COUNT] PROGMEM = {
+    [GLYPH_ARROW_UP]   = '^',
+    [GLYPH_ARROW_DOWN] = 'v',
+    [GLYPH_BAR_1]      = '|',
+    [GLYPH_BAR_2]      = '|',
+    [GLYPH_BAR_3]      = '|',
+    [GLYPH_BAR_4]      = '|',
+};
+
+static uint8_t slot_glyph[LCDBUF_DISPLAYS][LCDGLYPH_SLOTS];
+static uint16_t slot_used[LCDBUF_DISPLAYS][LCDGLYPH_SLOTS];    // use_clock at the last use
+static uint16_t use_clock = 0;
+static uint16_t uploads = 0;
+
+void lcdglyph_init(void) {
+    for (uint8_t d = 0; d < LCDBUF_DISPLAYS; d++) {
+        for (uint8_t s = 0; s < LCDGLYPH_SLOTS; s++) {
+            slot_glyph[d][s] = SLOT_FREE;
+            slot_used[d][s] = 0;
+        }
+    }
+    use_clock = 0;
+    uploads = 0;
+}
+
+// Free slot, else the least recently used one not on the screen, else the
+// least recently used one, on the selected display
+static uint8_t pick_slot(uint8_t d) {
+    uint8_t hidden = SLOT_FREE;
+    uint16_t hidden_age = 0;
+    uint8_t visible = 0;
+    uint16_t visible_age = 0;
+
+    for (uint8_t s = 0; s < LCDGLYPH_SLOTS; s++) {
+        if (slot_glyph[d][s] == SLOT_FREE) return s;
+
+        // Modular age stays correct when use_clock wraps
+        uint16_t age = use_clock - slot_used[d][s];
+        if (lcdbuf_contains(GLYPH_CODE(s))) {
+            if (age >= visible_age) {
+                visible_age = age;
+                visible = s;
+            }
+        } else if (hidden == SLOT_FREE || age >= hidden_age) {
+            hidden_age = age;
+            hidden = s;
+        }
+    }
+
+    return hidden != SLOT_FREE ? hidden : visible;
+}
+
+char lcdglyph_get(uint8_t glyph) {
+    uint8_t d = lcdbuf_selected();
+    use_clock++;
+
+    for (uint8_t s = 0; s < LCDGLYPH_SLOTS; s++) {
+        if (slot_glyph[d][s] == glyph) {
+            slot_used[d][s] = use_clock;
+            return GLYPH_CODE(s);
+        }
+    }
+
+    // A byte dropped from a full queue would leave a half-written glyph
+    // that the slot is never uploaded again for
+    if (lcd_free() < UPLOAD_BYTES) {
+        return pgm_read_byte(&fallbacks[glyph]);
+    }
+
+    uint8_t s = pick_slot(d);
+    slot_glyph[d][s] = glyph;
+    slot_used[d][s] = use_clock;
+    uploads++;
+
+    // The DDRAM address is lost, the framebuffer flush sets it again
+    lcd_select(d);
+    lcd_command((1 << LCD_CGRAM) | (s << 3));
+    for (uint8_t row = 0; row < GLYPH_ROWS; row++) {
+        lcd_data(pgm_read_byte(&glyphs[glyph][row]));
+    }
+
+    return GLYPH_CODE(s);
+}
+
+void lcdglyph_bar(uint8_t width, uint32_t filled, uint32_t total) {
+    uint16_t columns = (uint16_t)width * 5;
+    uint16_t lit = 0;
+
+    // Keep filled * columns within 32 bits
+    while (total > 0xFFFFFFUL) {
+        filled >>= 1;
+        total >>= 1;
+    }
+
+    if (total > 0) {
+        lit = (filled >= total) ? columns : (uint16_t)((filled * columns) / total);
+    }
+
+    for (uint8_t x = 0; x < width; x++) {
+        if (lit >= 5) {
+            lcdbuf_putc(CHAR_BLOCK);
+            lit -= 5;
+        } else if (lit > 0) {
+            lcdbuf_putc(lcdglyph_get(GLYPH_BAR_1 + lit - 1));
+            lit = 0;
+        } else {
+            lcdbuf_putc(' ');
+        }
+    }
+}
+
+uint16_t lcdglyph_uploads(void) {
+    return uploads;
+}
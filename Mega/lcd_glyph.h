@@ -0,0 +1,67 @@
+/*
+ * lcd_glyph.h
+ *
+ * Custom character manager for the HD44780. The controller holds 8
+ * user-defined characters in CGRAM; glyphs are uploaded on first use and
+ * stay resident until the slot is needed for another glyph. The least
+ * recently used slot that is not on the screen is replaced first.
+ *
+ * Glyphs are drawn through the framebuffer (lcd_buffer.h) using the
+ * character codes 0x08-0x0F, the aliases of CGRAM characters 0-7, so that
+ * a custom character is never mistaken for a string terminator.
+ */
+
+#ifndef LCD_GLYPH_H
+#define LCD_GLYPH_H
+
+#include <stdint.h>
+
+#define LCDGLYPH_SLOTS  8       // CGRAM characters of a 5x8 dot display
+
+/* Glyphs, see the bitmaps in lcd_glyph.c */
+enum {
+    GLYPH_ARROW_UP,
+    GLYPH_ARROW_DOWN,
+    GLYPH_BAR_1,                // left 1-4 pixel columns of a progress bar cell
+    GLYPH_BAR_2,
+    GLYPH_BAR_3,
+    GLYPH_BAR_4,
+    GLYPH_COUNT
+};
+
+/**
+ * @brief Mark all CGRAM slots as free
+ *
+ * Call after lcd_init().
+ */
+void lcdglyph_init(void);
+
+/**
+ * @brief Make a glyph resident and get its character code
+ * @param glyph Glyph from the list above
+ * @return Character code to draw with lcdbuf_putc()
+ *
+ * Uploads the glyph (9 bytes to the controller) only if it is not
+ * already in the CGRAM of the display selected with lcdbuf_select().
+ * If the LCD queue has no room for the upload, no slot is taken and a
+ * plain character ('^', 'v', '|') is returned; the glyph is uploaded
+ * by a later call.
+ */
+char lcdglyph_get(uint8_t glyph);
+
+/**
+ * @brief Draw a horizontal progress bar at the framebuffer cursor
+ * @param width Bar width in characters
+ * @param filled Progress, in any unit
+ * @param total Value of filled for a full bar
+ *
+ * Resolution is one pixel column, five per character.
+ */
+void lcdglyph_bar(uint8_t width, uint32_t filled, uint32_t total);
+
+/**
+ * @brief Get the number of glyph uploads since lcdglyph_init()
+ */
+uint16_t lcdglyph_uploads(void);
+
+#endif
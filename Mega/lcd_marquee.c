@@ -0,0 +1,109 @@
+/*
+ * lcd_marquee.c
+ *
+ * Scrolling messages using the display shift of the HD44780: one command
+ * byte per step instead of 16 data bytes and a cursor move.
+ */
+
+#include "lcd_marquee.h"
+#include "lcd_buffer.h"
+#include "lcd.h"
+
+#include <stddef.h>
+
+// Common includes
+#include "systick.h"
+
+// Both lines with their cursor moves and the home command
+#define MARQUEE_BYTES   (2 * (1 + LCDMARQ_COLS) + 1)
+
+static uint8_t display = 0;
+static bool active = false;
+static bool scrolling = false;
+static uint32_t last_step = 0;
+
+// Text waiting for room in the driver queue
+static const char *waiting[2];
+static bool written = false;
+
+// Write a whole DDRAM line, returns the text length
+static uint8_t write_line(uint8_t y, const char *text) {
+    uint8_t length = 0;
+
+    lcd_gotoxy(0, y);
+    for (uint8_t x = 0; x < LCDMARQ_COLS; x++) {
+        char c = ' ';
+        if (text != NULL && text[length] != '\0') {
+            c = text[length++];
+        }
+        lcd_data(c);
+    }
+    return length;
+}
+
+void lcdmarq_start(const char *line0, const char *line1) {
+    lcdmarq_stop();
+
+    // The framebuffer must not overwrite the text while it scrolls
+    display = lcdbuf_selected();
+    lcdbuf_hold(display, 1);
+
+    waiting[0] = line0;
+    waiting[1] = line1;
+    written = false;
+    active = true;
+    scrolling = false;
+
+    lcdmarq_poll();
+}
+
+// Writes the text once the whole message fits in the driver queue
+static void write_message(void) {
+    if (lcd_free() < MARQUEE_BYTES) return;
+
+    lcd_select(display);
+    lcd_home(); // undo the shift of a previous marquee
+
+    uint8_t length = write_line(0, waiting[0]);
+    uint8_t length1 = write_line(1, waiting[1]);
+    if (length1 > length) length = length1;
+
+    written = true;
+    scrolling = length > LCDBUF_COLS;
+    last_step = SYSTICK_millis();
+}
+
+void lcdmarq_stop(void) {
+    if (!active) return;
+
+    active = false;
+    lcd_select(display);
+    lcd_home();             // display shift back to 0
+
+    // The glass holds the marquee text
+    uint8_t selected = lcdbuf_selected();
+    lcdbuf_select(display);
+    lcdbuf_invalidate();
+    lcdbuf_select(selected);
+    lcdbuf_hold(display, 0);
+}
+
+void lcdmarq_poll(void) {
+    if (!active) return;
+    if (!written) {
+        write_message();
+        return;
+    }
+    if (!scrolling) return;
+
+    uint32_t now = SYSTICK_millis();
+    if (now - last_step < LCDMARQ_STEP_MS) return;
+    last_step = now;
+
+    lcd_select(display);
+    lcd_command(LCD_MOVE_DISP_LEFT);
+}
+
+bool lcdmarq_active(void) {
+    return active;
+}
@@ -0,0 +1,55 @@
+/*
+ * lcd_marquee.h
+ *
+ * Scrolling messages using the display shift of the HD44780. Each line of
+ * the controller holds 40 characters of which 16 are visible; a message
+ * is written into the full line once and then scrolled with one
+ * LCD_MOVE_DISP_LEFT command per step instead of rewriting the line.
+ *
+ * The shift moves both lines together, so a marquee owns the whole
+ * display it runs on (the one selected with lcdbuf_select()): both lines
+ * scroll and the framebuffer holds back that display while the marquee is
+ * active. Stopping the marquee resets the shift and makes the next flush
+ * redraw the framebuffer. One marquee runs at a time.
+ */
+
+#ifndef LCD_MARQUEE_H
+#define LCD_MARQUEE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LCDMARQ_COLS        40      // DDRAM characters per line
+#define LCDMARQ_STEP_MS     300     // time between two shifts
+
+/**
+ * @brief Show a message and start scrolling it
+ * @param line0 Text of the first line, up to 40 characters, NULL for blank
+ * @param line1 Text of the second line, up to 40 characters, NULL for blank
+ *
+ * The lines wrap around after 40 characters, shorter texts are padded
+ * with spaces. If both fit the display the message is shown without
+ * scrolling. The text is written once the driver queue has room for it,
+ * so the strings must stay valid while the marquee runs. Requires
+ * SYSTICK_init().
+ */
+void lcdmarq_start(const char *line0, const char *line1);
+
+/**
+ * @brief Stop scrolling and return the display to the framebuffer
+ */
+void lcdmarq_stop(void);
+
+/**
+ * @brief Shift the display when the next step is due
+ *
+ * Call from the main loop; does nothing while no marquee is active.
+ */
+void lcdmarq_poll(void);
+
+/**
+ * @brief Check whether a marquee owns the display
+ */
+bool lcdmarq_active(void);
+
+#endif
@@ -15,60 +15,242 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
 
 // Mega includes
 #include "lcd.h"    
+#include "lcd_buffer.h"
+#include "lcd_glyph.h"
+#include "lcd_marquee.h"
 #include "keypad.h"
+#include "emergency.h"
+#include "motion.h"
+#include "traffic.h"
+#include "upload.h"
 
 // Common includes
 #include "usart.h" // for debugging
 #include "twi.h"
 #include "message.h"
+#include "systick.h"
+#include "idle.h"
+#include "hsm.h"
+
+#define LCD_UPDATE_MS    200  // Position/ETA refresh interval while moving
+#define DOOR_OPENING_MS  1000
+#define DOOR_OPEN_MS     4000
+#define DOOR_CLOSING_MS  1000
+#define EMERGENCY_DOOR_MS 5000  // door held open for evacuation
+#define FAULT_MS         1000
+#define ENTRY_TIMEOUT_MS 3000  // a floor entry is committed after this long without a key
+#define CALL_DELAY_MS    1500  // time to queue more calls before the next queued call is served
+#define CALL_QUEUE_SIZE  8
+
+/* Keypad commands, the digits enter a floor */
+#define KEY_COMMIT       '#'   // go to the floor entered so far
+#define KEY_CANCEL       '*'   // drop the floor entered so far
+#define KEY_DOOR_OPEN    'A'   // open the door, or keep it open
+#define KEY_DOOR_CLOSE   'B'   // close the door now
+#define KEY_QUEUE        'C'   // queue the floor entered so far and enter another one
+#define KEY_CLEAR_QUEUE  'D'   // drop all queued calls
 
 /* State Management */
-typedef enum {
-    IDLE,
-    MOVING,
-    DOOR_OPEN,
-    EMERGENCY,
-    FAULT
-} ElevatorState;
-
-volatile ElevatorState state = IDLE;
+enum {
+    ST_NORMAL,                      // everything except the emergency
+    ST_IDLE,
+    ST_IDLE_WAITING,                // waiting for the first digit
+    ST_IDLE_ENTRY,                  // first digit received, waiting for the second
+    ST_MOVING,
+    ST_DOOR,
+    ST_DOOR_OPENING,
+    ST_DOOR_OPEN,
+    ST_DOOR_CLOSING,
+    ST_FAULT,
+    ST_EMERGENCY,
+    ST_EMERGENCY_WAIT_FIRST_KEY,
+    ST_EMERGENCY_DOOR_OPEN,
+    ST_EMERGENCY_DOOR_CLOSED,
+    ST_EMERGENCY_WAIT_SECOND_KEY,
+    ST_COUNT
+};
+
+enum {
+    EV_KEY = HSM_EV_USER,           // param: ASCII key
+    EV_ARRIVED,                     // motion reached the target floor
+    EV_EMERGENCY                    // emergency button latched
+};
+
+Hsm elevator;
+HsmStateStats elevator_stats[ST_COUNT];
+
 volatile uint8_t currentFloor = 0;
 volatile uint8_t selectedFloor = 0;
-volatile uint8_t emergencyActivated = 0;
+volatile uint8_t parking = 0; // current trip is an idle repositioning, no passengers
+uint8_t park_floor = TRAFFIC_NO_FLOOR;
+uint32_t last_update = 0;
+uint32_t last_landing_update = 0;
+int32_t trip_start_mm = 0;
 
-uint8_t requestFloorFromKeypad(uint8_t selectedFloor){
-    
-    uint8_t key_signal = KEYPAD_GetKey();
-    
-    if (key_signal != 'z' && key_signal >= '0' && key_signal <= '9') {
-
-        selectedFloor = key_signal - '0';
-        lcd_gotoxy(0,0);
-	    char lcd_text[17];
-		sprintf(lcd_text,"Floor:%02d Sel:%02d",currentFloor,selectedFloor);
-		lcd_puts(lcd_text);
-        //startWaitingSignal();  //odotus signaali, jos ei tule, niin jatkaa eteenpäin??? tai sitten painaa vaan jotain nappia, niin jatkuu...
-        key_signal = KEYPAD_GetKey();
-        if (key_signal != 'z' && key_signal >= '0' && key_signal <= '9'){
-            selectedFloor = selectedFloor * 10 + key_signal - '0';
-            char lcd_text[16];
-			sprintf(lcd_text,"Floor:%02d Sel:%02d",currentFloor,selectedFloor);
-			lcd_gotoxy(0,0);
-			lcd_puts(lcd_text);
-        }    
+// Floor typed while moving, first digit; NO_STOP_ENTRY when none
+#define NO_STOP_ENTRY 0xFF
+uint8_t stop_entry = NO_STOP_ENTRY;
+
+// EV_EMERGENCY found the event queue full, the main loop posts it again
+volatile bool emergency_unposted = false;
+
+// Calls queued with KEY_QUEUE, served nearest first
+uint8_t calls[CALL_QUEUE_SIZE];
+uint8_t call_count = 0;
+
+/* Helper Functions */
+void show_floors() {
+    char lcd_text[17];
+    sprintf(lcd_text,"Floor:%02d Sel:%02d",currentFloor,selectedFloor);
+    lcdbuf_gotoxy(0,0);
+    lcdbuf_puts(lcd_text);
+}
+
+/* Queued calls on line 1, "Calls: 3 7 12" */
+void show_calls() {
+    char lcd_text[LCDBUF_COLS + 1] = "";
+    uint8_t length = 0;
+
+    if (call_count > 0) length = sprintf(lcd_text, "Calls:");
+    for (uint8_t i = 0; i < call_count && length + 3 <= LCDBUF_COLS; i++) {
+        length += sprintf(lcd_text + length, " %d", calls[i]);
     }
-    return selectedFloor;
+    while (length < LCDBUF_COLS) lcd_text[length++] = ' ';
+    lcd_text[length] = '\0';
+
+    lcdbuf_gotoxy(0,1);
+    lcdbuf_puts(lcd_text);
 }
 
-/* Helper Functions */
-void go_to_floor(uint8_t floor) {
+bool key_is_digit() {
+    uint8_t key = HSM_event_param(&elevator);
+    return key >= '0' && key <= '9';
+}
+
+bool key_is_commit()      { return HSM_event_param(&elevator) == KEY_COMMIT; }
+bool key_is_cancel()      { return HSM_event_param(&elevator) == KEY_CANCEL; }
+bool key_is_door_open()   { return HSM_event_param(&elevator) == KEY_DOOR_OPEN; }
+bool key_is_door_close()  { return HSM_event_param(&elevator) == KEY_DOOR_CLOSE; }
+bool key_is_queue()       { return HSM_event_param(&elevator) == KEY_QUEUE; }
+bool key_is_clear_queue() { return HSM_event_param(&elevator) == KEY_CLEAR_QUEUE; }
+
+void open_door(uint32_t ms) {
+    // The door LED fades up while the door opens
+    TWI_send_message(build_message_dim(SPEAKER_PLAY, 1, DIM_LED_DOOR, 255, ms)); // Send message to UNO
+    lcdbuf_gotoxy(0,1);
+    lcdbuf_puts("Door Opening... ");
+    HSM_arm_timer(&elevator, ms);
+}
+
+void close_door(const char *text, uint32_t ms) {
+    lcdbuf_gotoxy(0,1);
+    lcdbuf_puts(text);
+    TWI_send_message(build_message_dim(SPEAKER_PLAY, 2, DIM_LED_DOOR, 0, ms)); // Send message to UNO
+    HSM_arm_timer(&elevator, ms);
+}
+
+/* Position and ETA display while moving, also detects the arrival */
+void update_travel() {
+    // The emergency path halts motion on the next tick, that is no arrival
+    if (!MOTION_is_moving()) {
+        if (!EMERGENCY_motion_stopped()) HSM_post(&elevator, EV_ARRIVED, 0);
+        return;
+    }
+
+    // Refresh position and ETA a few times per second
+    uint32_t now = SYSTICK_millis();
+    if (now - last_update < LCD_UPDATE_MS) return;
+    last_update = now;
+
+    char msg[17];
+    currentFloor = MOTION_current_floor();
+    uint32_t eta = MOTION_eta_ms(selectedFloor);
+    int32_t target_mm = (int32_t)selectedFloor * MOTION_FLOOR_HEIGHT_MM;
+
+    // "Floor:05 ^ 12.3s", the arrow is a custom character
+    lcdbuf_gotoxy(0,0);
+    sprintf(msg, "Floor:%02d ", currentFloor);
+    lcdbuf_puts(msg);
+    lcdbuf_putc(lcdglyph_get(target_mm >= trip_start_mm ? GLYPH_ARROW_UP : GLYPH_ARROW_DOWN));
+    sprintf(msg, "%3lu.%lus", eta / 1000, (eta % 1000) / 100);
+    lcdbuf_puts(msg);
+
+    // Trip progress with one pixel column per 1/80 of the trip
+    lcdbuf_gotoxy(0,1);
+    lcdglyph_bar(LCDBUF_COLS, labs(MOTION_position_mm() - trip_start_mm),
+                 labs(target_mm - trip_start_mm));
+}
+
+/* Landing indicators: display d stands at floor d - 1 */
+void update_landings() {
+    uint32_t now = SYSTICK_millis();
+    if (now - last_landing_update < LCD_UPDATE_MS) return;
+    last_landing_update = now;
+
+    bool moving = HSM_is_in(&elevator, ST_MOVING);
+    char msg[17];
+
+    for (uint8_t d = 1; d < LCDBUF_DISPLAYS; d++) {
+        uint8_t landing = d - 1;
+        lcdbuf_select(d);
+
+        sprintf(msg, "Car at floor %02d ", MOTION_current_floor());
+        lcdbuf_gotoxy(0,0);
+        lcdbuf_puts(msg);
+
+        lcdbuf_gotoxy(0,1);
+        if (HSM_is_in(&elevator, ST_EMERGENCY)) {
+            lcdbuf_puts(" Out of service ");
+        } else if (moving) {
+            bool up = (int32_t)selectedFloor * MOTION_FLOOR_HEIGHT_MM >= trip_start_mm;
+            lcdbuf_putc(lcdglyph_get(up ? GLYPH_ARROW_UP : GLYPH_ARROW_DOWN));
+            if (selectedFloor == landing) {
+                uint32_t eta = MOTION_eta_ms(landing);
+                sprintf(msg, " Arriving %3lus ", (eta + 999) / 1000);
+            } else {
+                sprintf(msg, " Going to %02d   ", selectedFloor);
+            }
+            lcdbuf_puts(msg);
+        } else if (MOTION_is_at_floor(landing)) {
+            lcdbuf_puts("  Car is here   ");
+        } else {
+            lcdbuf_puts("                ");
+        }
+    }
+
+    lcdbuf_select(0);
+}
+
+/* Entry actions */
+void idle_entry() {
+    selectedFloor = currentFloor;
+    lcdbuf_clear();
+    show_floors();
+}
+
+void idle_waiting_entry() {
+    show_calls();
+
+    // Serve the queued calls, or give up after a while so that an idle car can be parked
+    HSM_arm_timer(&elevator, call_count > 0 ? CALL_DELAY_MS : TRAFFIC_PARK_DELAY_MS);
+}
+
+void idle_entry_entry() {
+    lcdbuf_gotoxy(0,1);
+    lcdbuf_puts("#=Go *=Del C=Add");
+    HSM_arm_timer(&elevator, ENTRY_TIMEOUT_MS);
+}
+
+void moving_entry() {
     uint8_t sound_id;
 
     // funny easter eggs for some floors
-    switch (floor) {
+    switch (selectedFloor) {
         case 69:
             sound_id = 5; // Never Gonna Give You Up
             break;
@@ -85,31 +267,310 @@ void go_to_floor(uint8_t floor) {
             sound_id = 3; // Harry Potter
             break;
     }
-    // Signal movement start
-    TWI_send_message(build_message_data(LED_MOVING_ON | SPEAKER_PLAY, sound_id));
-    
-    char msg[17];
+    // Signal movement start, parking trips run without music
+    if (parking) {
+        TWI_send_message(build_message(LED_MOVING_ON));
+    } else {
+        TWI_send_message(build_message_data(LED_MOVING_ON | SPEAKER_PLAY, sound_id));
+    }
 
-    while (currentFloor != floor) {
-        if (emergencyActivated) return;
-        if (floor > currentFloor) {
-			lcd_gotoxy(0,1);
-			lcd_puts("Moving up       ");
-            currentFloor++;
-        } else {
-			lcd_gotoxy(0,1);
-            lcd_puts("Moving down     ");
-			currentFloor--;
+    last_update = 0;
+    stop_entry = NO_STOP_ENTRY;
+    trip_start_mm = MOTION_position_mm();
+    MOTION_go_to(selectedFloor);
+}
+
+void door_opening_entry() { open_door(DOOR_OPENING_MS); }
+void door_closing_entry() { close_door("Door Closing... ", DOOR_CLOSING_MS); }
+
+void door_open_entry() {
+    lcdbuf_gotoxy(0,1);
+    lcdbuf_puts("Door Open       ");
+    HSM_arm_timer(&elevator, DOOR_OPEN_MS);
+}
+
+void door_hold() {
+    HSM_arm_timer(&elevator, DOOR_OPEN_MS); // start the open time again
+}
+
+void fault_entry() {
+    lcdbuf_clear();
+    lcdbuf_puts("Same Floor Error");
+
+    TWI_send_message(build_message(LED_MOVING_BLINK)); // Send message to UNO
+
+    // CALL UNO: blink_led(&MOVEMENT_LED_PORT, MOVEMENT_LED_PIN, 3, 300);
+    HSM_arm_timer(&elevator, FAULT_MS); // Simulate error indication
+}
+
+void emergency_entry() {
+    currentFloor = MOTION_current_floor();
+    parking = 0;
+
+    lcdbuf_gotoxy(0,0);
+    lcdbuf_puts("   EMERGENCY!   ");
+    lcdbuf_gotoxy(0,1);
+    lcdbuf_puts("Press any Button");
+
+    TWI_send_message(build_message(LED_MOVING_BLINK)); // Send message to UNO
+}
+
+void emergency_door_open_entry() { open_door(EMERGENCY_DOOR_MS); }
+void emergency_door_closed_entry() { close_door("Door Closed     ", DOOR_CLOSING_MS); }
+
+void emergency_wait_first_key_entry() {
+    lcdmarq_start("*** EMERGENCY STOP ***", "Press any button to open the door");
+}
+
+void emergency_wait_second_key_entry() {
+    lcdmarq_start("*** EMERGENCY STOP ***", "Press any button to resume service");
+
+    TWI_send_message(build_message_data(SPEAKER_PLAY, 0)); // Send message to UNO
+}
+
+/* Exit actions */
+void marquee_exit() {
+    lcdmarq_stop();
+}
+
+/* Guards */
+// Floor the entry ends with: a second digit appends, '#' or the timeout keep one digit
+uint8_t entered_floor() {
+    uint8_t key = HSM_event_param(&elevator);
+    if (key >= '0' && key <= '9') {
+        return selectedFloor * 10 + key - '0';
+    }
+    return selectedFloor;
+}
+
+bool entry_is_other_floor() {
+    return !MOTION_is_at_floor(entered_floor());
+}
+
+// The second digit or '#' ends the entry
+bool entry_done() {
+    return key_is_digit() || key_is_commit();
+}
+
+bool entry_done_other_floor() {
+    return entry_done() && entry_is_other_floor();
+}
+
+// Floor a stop entry ends with, as entered_floor()
+uint8_t entered_stop() {
+    uint8_t key = HSM_event_param(&elevator);
+    if (key >= '0' && key <= '9') {
+        return stop_entry * 10 + key - '0';
+    }
+    return stop_entry;
+}
+
+// The second digit or '#' ends a stop entry
+bool stop_entry_done() {
+    return stop_entry != NO_STOP_ENTRY && entry_done();
+}
+
+// The stop is reached before the destination and the car can still brake for it
+bool stop_on_the_way() {
+    if (!stop_entry_done()) return false;
+
+    uint8_t floor = entered_stop();
+    return floor != selectedFloor && MOTION_eta_ms(floor) < MOTION_eta_ms(selectedFloor)
+        && MOTION_can_stop_at(floor);
+}
+
+bool call_pending() {
+    return call_count > 0;
+}
+
+bool park_floor_available() {
+    park_floor = TRAFFIC_predict_floor();
+    return park_floor != TRAFFIC_NO_FLOOR && !MOTION_is_at_floor(park_floor);
+}
+
+bool is_parking() {
+    return parking;
+}
+
+/* Transition actions */
+void first_digit() {
+    selectedFloor = HSM_event_param(&elevator) - '0';
+    show_floors();
+}
+
+void commit_entry() {
+    selectedFloor = entered_floor();
+    show_floors();
+}
+
+void commit_call() {
+    commit_entry();
+    TRAFFIC_record_call(currentFloor); // passenger boarded here
+}
+
+// Queue a call unless it is already queued or there is no room
+bool add_call(uint8_t floor) {
+    bool queued = MOTION_is_at_floor(floor) || call_count == CALL_QUEUE_SIZE;
+
+    for (uint8_t i = 0; i < call_count; i++) {
+        if (calls[i] == floor) queued = true;
+    }
+    if (!queued) calls[call_count++] = floor;
+    return !queued;
+}
+
+void queue_call() {
+    if (add_call(entered_floor())) TRAFFIC_record_call(currentFloor);
+}
+
+void stop_digit() {
+    stop_entry = HSM_event_param(&elevator) - '0';
+}
+
+void stop_cancel() {
+    stop_entry = NO_STOP_ENTRY;
+}
+
+// Re-plan the trip for a stop on the way, the destination is queued behind it
+void add_stop() {
+    uint8_t floor = entered_stop();
+    stop_entry = NO_STOP_ENTRY;
+
+    if (!MOTION_go_to(floor)) return;
+    if (!parking) add_call(selectedFloor);
+    parking = 0; // somebody wants to get off
+    selectedFloor = floor;
+    last_update = 0;
+    printf("Stopping at floor %d on the way\n", floor);
+}
+
+// A stop the car has passed or cannot brake for is served after the trip
+void queue_stop() {
+    if (entered_stop() != selectedFloor) add_call(entered_stop());
+    stop_entry = NO_STOP_ENTRY;
+}
+
+void clear_calls() {
+    call_count = 0;
+    if (HSM_is_in(&elevator, ST_IDLE_WAITING)) show_calls();
+}
+
+// Take the queued call the car reaches first
+void dispatch_call() {
+    uint8_t best = 0;
+    uint32_t best_eta = UINT32_MAX;
+
+    for (uint8_t i = 0; i < call_count; i++) {
+        uint32_t eta = MOTION_eta_ms(calls[i]);
+        if (eta < best_eta) {
+            best_eta = eta;
+            best = i;
         }
-        lcd_gotoxy(0,0);
-        sprintf(msg, "Floor:%02d", currentFloor);
-        lcd_puts(msg);
-        _delay_ms(1000);  // Simulate travel time
-	}
+    }
+
+    selectedFloor = calls[best];
+    calls[best] = calls[--call_count];
+    show_floors();
+}
+
+void start_parking() {
+    // Nobody called for a while: park where demand is expected
+    printf("Parking at floor %d\n", park_floor);
+    selectedFloor = park_floor;
+    parking = 1;
+}
+
+void end_trip() {
+    currentFloor = MOTION_current_floor();
+    parking = 0;
+
+    // A queued call for this floor is served too
+    for (uint8_t i = 0; i < call_count; i++) {
+        if (calls[i] == currentFloor) calls[i--] = calls[--call_count];
+    }
+    show_floors();
 
     TWI_send_message(build_message(LED_MOVING_OFF | SPEAKER_STOP)); // Send message to UNO
+}
 
+void resolve_emergency() {
+    TWI_send_message(build_message(SPEAKER_STOP)); // Send message to UNO
+
+    EMERGENCY_report();
+    EMERGENCY_clear();
 }
+
+/* State machine, see docs/statemachine.mermaid */
+#define STATE(parent, initial, entry, exit, name) { parent, initial, entry, exit, name }
+
+static const char name_normal[] PROGMEM = "NORMAL";
+static const char name_idle[] PROGMEM = "IDLE";
+static const char name_idle_waiting[] PROGMEM = " WaitingForInput";
+static const char name_idle_entry[] PROGMEM = " ProcessingInput";
+static const char name_moving[] PROGMEM = "MOVING";
+static const char name_door[] PROGMEM = "DOOR_SEQUENCE";
+static const char name_door_opening[] PROGMEM = " Opening";
+static const char name_door_open[] PROGMEM = " Open";
+static const char name_door_closing[] PROGMEM = " Closing";
+static const char name_fault[] PROGMEM = "FAULT";
+static const char name_emergency[] PROGMEM = "EMERGENCY";
+static const char name_emergency_first[] PROGMEM = " WaitFirstKey";
+static const char name_emergency_open[] PROGMEM = " DoorOpen";
+static const char name_emergency_closed[] PROGMEM = " DoorClosed";
+static const char name_emergency_second[] PROGMEM = " WaitSecondKey";
+
+static const HsmState elevator_states[ST_COUNT] PROGMEM = {
+    [ST_NORMAL]                    = STATE(HSM_NO_STATE, ST_IDLE, NULL, NULL, name_normal),
+    [ST_IDLE]                      = STATE(ST_NORMAL, ST_IDLE_WAITING, idle_entry, NULL, name_idle),
+    [ST_IDLE_WAITING]              = STATE(ST_IDLE, HSM_NO_STATE, idle_waiting_entry, NULL, name_idle_waiting),
+    [ST_IDLE_ENTRY]                = STATE(ST_IDLE, HSM_NO_STATE, idle_entry_entry, NULL, name_idle_entry),
+    [ST_MOVING]                    = STATE(ST_NORMAL, HSM_NO_STATE, moving_entry, NULL, name_moving),
+    [ST_DOOR]                      = STATE(ST_NORMAL, ST_DOOR_OPENING, NULL, NULL, name_door),
+    [ST_DOOR_OPENING]              = STATE(ST_DOOR, HSM_NO_STATE, door_opening_entry, NULL, name_door_opening),
+    [ST_DOOR_OPEN]                 = STATE(ST_DOOR, HSM_NO_STATE, door_open_entry, NULL, name_door_open),
+    [ST_DOOR_CLOSING]              = STATE(ST_DOOR, HSM_NO_STATE, door_closing_entry, NULL, name_door_closing),
+    [ST_FAULT]                     = STATE(ST_NORMAL, HSM_NO_STATE, fault_entry, NULL, name_fault),
+    [ST_EMERGENCY]                 = STATE(HSM_NO_STATE, ST_EMERGENCY_WAIT_FIRST_KEY, emergency_entry, NULL, name_emergency),
+    [ST_EMERGENCY_WAIT_FIRST_KEY]  = STATE(ST_EMERGENCY, HSM_NO_STATE, emergency_wait_first_key_entry, marquee_exit, name_emergency_first),
+    [ST_EMERGENCY_DOOR_OPEN]       = STATE(ST_EMERGENCY, HSM_NO_STATE, emergency_door_open_entry, NULL, name_emergency_open),
+    [ST_EMERGENCY_DOOR_CLOSED]     = STATE(ST_EMERGENCY, HSM_NO_STATE, emergency_door_closed_entry, NULL, name_emergency_closed),
+    [ST_EMERGENCY_WAIT_SECOND_KEY] = STATE(ST_EMERGENCY, HSM_NO_STATE, emergency_wait_second_key_entry, marquee_exit, name_emergency_second),
+};
+
+static const HsmTransition elevator_transitions[] PROGMEM = {
+    // source                       event           target                          guard                   action
+    { ST_IDLE_WAITING,              EV_KEY,         ST_IDLE_ENTRY,                  key_is_digit,           first_digit },
+    { ST_IDLE_WAITING,              HSM_EV_TIMEOUT, ST_MOVING,                      call_pending,           dispatch_call },
+    { ST_IDLE_WAITING,              HSM_EV_TIMEOUT, ST_MOVING,                      park_floor_available,   start_parking },
+    { ST_IDLE_WAITING,              HSM_EV_TIMEOUT, ST_IDLE_WAITING,                NULL,                   NULL },
+    { ST_IDLE_ENTRY,                EV_KEY,         ST_MOVING,                      entry_done_other_floor, commit_call },
+    { ST_IDLE_ENTRY,                EV_KEY,         ST_FAULT,                       entry_done,             commit_entry },
+    { ST_IDLE_ENTRY,                EV_KEY,         ST_IDLE,                        key_is_cancel,          NULL },
+    { ST_IDLE_ENTRY,                EV_KEY,         ST_IDLE,                        key_is_queue,           queue_call },
+    { ST_IDLE_ENTRY,                HSM_EV_TIMEOUT, ST_MOVING,                      entry_is_other_floor,   commit_call },
+    { ST_IDLE_ENTRY,                HSM_EV_TIMEOUT, ST_FAULT,                       NULL,                   commit_entry },
+    { ST_IDLE,                      EV_KEY,         ST_DOOR,                        key_is_door_open,       NULL },
+    { ST_MOVING,                    EV_KEY,         HSM_INTERNAL,                   stop_on_the_way,        add_stop },
+    { ST_MOVING,                    EV_KEY,         HSM_INTERNAL,                   stop_entry_done,        queue_stop },
+    { ST_MOVING,                    EV_KEY,         HSM_INTERNAL,                   key_is_digit,           stop_digit },
+    { ST_MOVING,                    EV_KEY,         HSM_INTERNAL,                   key_is_cancel,          stop_cancel },
+    { ST_MOVING,                    EV_ARRIVED,     ST_IDLE,                        is_parking,             end_trip },
+    { ST_MOVING,                    EV_ARRIVED,     ST_DOOR,                        NULL,                   end_trip },
+    { ST_DOOR_OPENING,              HSM_EV_TIMEOUT, ST_DOOR_OPEN,                   NULL,                   NULL },
+    { ST_DOOR_OPEN,                 HSM_EV_TIMEOUT, ST_DOOR_CLOSING,                NULL,                   NULL },
+    { ST_DOOR_OPEN,                 EV_KEY,         HSM_INTERNAL,                   key_is_door_open,       door_hold },
+    { ST_DOOR_OPEN,                 EV_KEY,         ST_DOOR_CLOSING,                key_is_door_close,      NULL },
+    { ST_DOOR_CLOSING,              HSM_EV_TIMEOUT, ST_IDLE,                        NULL,                   NULL },
+    { ST_DOOR_CLOSING,              EV_KEY,         ST_DOOR_OPENING,                key_is_door_open,       NULL },
+    { ST_FAULT,                     HSM_EV_TIMEOUT, ST_IDLE,                        NULL,                   NULL },
+    { ST_NORMAL,                    EV_KEY,         HSM_INTERNAL,                   key_is_clear_queue,     clear_calls },
+    { ST_NORMAL,                    EV_EMERGENCY,   ST_EMERGENCY,                   NULL,                   NULL },
+    { ST_EMERGENCY_WAIT_FIRST_KEY,  EV_KEY,         ST_EMERGENCY_DOOR_OPEN,         NULL,                   NULL },
+    { ST_EMERGENCY_DOOR_OPEN,       HSM_EV_TIMEOUT, ST_EMERGENCY_DOOR_CLOSED,       NULL,                   NULL },
+    { ST_EMERGENCY_DOOR_CLOSED,     HSM_EV_TIMEOUT, ST_EMERGENCY_WAIT_SECOND_KEY,   NULL,                   NULL },
+    { ST_EMERGENCY_WAIT_SECOND_KEY, EV_KEY,         ST_IDLE,                        NULL,                   resolve_emergency },
+};
+
 void setup(){
 	lcd_init(LCD_DISP_ON);
 	lcd_clrscr();
@@ -117,67 +578,118 @@ void setup(){
 	lcd_gotoxy(0,1);
 	lcd_puts("Elevator!");
     KEYPAD_Init();
-	_delay_ms(1000);
+    KEYPAD_StartScanner();
+	IDLE_delay_ms(1000);
 	lcd_clrscr();
-    char lcd_text[17];
-    sprintf(lcd_text,"Floor %02d",currentFloor);
-    itoa(selectedFloor,lcd_text,10);
-    lcd_puts(lcd_text);
+	lcdbuf_init();
+	lcdglyph_init();
 }
 
-void door_sequence() {
-    TWI_send_message(build_message_data(LED_DOOR_OPEN | SPEAKER_PLAY, 1)); // Send message to UNO
-    lcd_gotoxy(0,1);
-	
-    lcd_puts("Door Opening... ");
-    _delay_ms(5000); // Simulate door open time
-    lcd_gotoxy(0,1);
-    lcd_puts("Door Closed     ");
-    TWI_send_message(build_message_data(LED_DOOR_CLOSE | SPEAKER_PLAY, 2)); // Send message to UNO
-    _delay_ms(1000); // Simulate door closed time
+/* Called from the emergency interrupt once the stop frame has been posted */
+void on_emergency_latch() {
+    if (!HSM_post(&elevator, EV_EMERGENCY, 0)) {
+        emergency_unposted = true;
+    }
 }
 
-void handle_emergency() {
-    lcd_gotoxy(0,0);
-    lcd_puts("   EMERGENCY!   ");
-    lcd_gotoxy(0,1);
-    lcd_puts("Press any Button");
+/* Console command 't': read the time of day as HHMM */
+void set_clock_from_console() {
+    uint16_t digits[4];
+    for (uint8_t i = 0; i < 4; i++) {
+        digits[i] = USART_receive() - '0';
+        if (digits[i] > 9) return;
+    }
+    uint16_t hours = digits[0] * 10 + digits[1];
+    uint16_t minutes = digits[2] * 10 + digits[3];
+    if (hours > 23 || minutes > 59) return;
 
-    TWI_send_message(build_message(LED_MOVING_BLINK)); // Send message to UNO
+    TRAFFIC_set_clock(hours * 60 + minutes);
+    printf("Clock set to %02u:%02u\n", hours, minutes);
+}
 
-    KEYPAD_GetKey();    //waits for key input
-    door_sequence();
-    lcd_gotoxy(0,1);
-    lcd_puts("Press any Button");
+/* Melody of console command 'u', in the format of Uno/Buzzer.h: the base
+   pitch, then per note (pitch - base + 1) << 3 | length code */
+#define UPLOAD_NOTE(pitch, code) (((pitch) << 3) | (code))
+const uint8_t upload_melody[] PROGMEM = {
+    49,                     // base pitch C5
+    UPLOAD_NOTE(1, 2),      // C5 eighth
+    UPLOAD_NOTE(5, 2),      // E5 eighth
+    UPLOAD_NOTE(8, 2),      // G5 eighth
+    UPLOAD_NOTE(13, 4),     // C6 quarter
+    UPLOAD_NOTE(8, 2),      // G5 eighth
+    UPLOAD_NOTE(13, 6),     // C6 half
+    UPLOAD_NOTE(31, 0)      // MELODY_END
+};
+
+/* Console command 'u': upload the melody above to UNO slot 0 or 1 and play it */
+void upload_sound_from_console() {
+    uint8_t slot = USART_receive() - '0';
+    if (slot >= UPLOAD_SLOTS) return;
+
+    uint8_t status = UPLOAD_send_sound(slot, 160, 0, 1, upload_melody, sizeof(upload_melody));
+    if (status != 0) {
+        printf("Upload to slot %u failed: 0x%02X\n", slot, status);
+        return;
+    }
+    TWI_send_message(build_message_sound(SPEAKER_PLAY, UPLOAD_SOUND_ID(slot)));
+    printf("Sound %u uploaded to slot %u\n", UPLOAD_SOUND_ID(slot), slot);
+}
 
-    TWI_send_message(build_message_data(SPEAKER_PLAY, 0)); // Send message to UNO
+/* One run of the LCD benchmark with the pacing in use */
+void lcd_measure() {
+    const uint8_t rounds = 8;
+    uint16_t bytes = 0;
+    uint32_t spins = 0;
+
+    uint32_t start = SYSTICK_micros();
+    for (uint8_t r = 0; r < rounds; r++) {
+        for (uint8_t y = 0; y < LCD_LINES; y++) {
+            // Async: the caller only waits when the queue is full
+            while (lcd_free() < 1 + LCD_DISP_LENGTH) spins++;
+            lcd_gotoxy(0, y);
+            for (uint8_t x = 0; x < LCD_DISP_LENGTH; x++) {
+                lcd_data('0' + (r + x) % 10);
+            }
+            bytes += 1 + LCD_DISP_LENGTH;
+        }
+    }
+    while (lcd_pending()) spins++;
+    uint32_t elapsed = SYSTICK_micros() - start;
+
+    // The clear is only over when the next command is taken
+    start = SYSTICK_micros();
+    lcd_clrscr();
+    lcd_gotoxy(0, 0);
+    while (lcd_pending()) {}
+    uint32_t clear = SYSTICK_micros() - start;
+
+    printf("  %-10s %u bytes in %lu us, %lu us/byte, %lu bytes/s, clear %lu us, spins %lu\n",
+           lcd_write_only() ? "write-only" : "busy flag",
+           bytes, elapsed, elapsed / bytes, (bytes * 1000000UL) / elapsed, clear, spins);
+}
 
-    KEYPAD_GetKey();    // Wait for another key to stop melody
-    
-    TWI_send_message(build_message(SPEAKER_STOP)); // Send message to UNO
+/* Console command 'l': LCD throughput with busy-flag and with write-only
+   pacing, where the driver can switch (without LCD_WRITE_ONLY) */
+void lcd_benchmark() {
+    if (lcdmarq_active()) return; // the marquee owns the display
 
-    emergencyActivated = 0;
-    state = IDLE;
-    selectedFloor = currentFloor;
-}
+    uint8_t configured = lcd_write_only();
 
- /* Initialize Emergency Interrupt */
-void init_emergency_interrupt() {
-    EMERGENCY_INT_DDR &= ~(1 << PD3); // clears the bit, setting the pin as an input.
-    EMERGENCY_INT_PORT |= (1 << PD3); // enables the internal pull-up resistor, keeping the pin HIGH when idle.
-    EICRA |= (1 << ISC31);    // Trigger on FALLING edge (HIGH --> LOW)
-    EICRA |= (1 << ISC30);    // combination 1,1 sets button to trigger when LOW --> HIGH
-  
-	EIMSK |= (1 << INT3);     // Enable INT3 interrupt
+    lcd_select(0);
+    if (LCD_ASYNC) {
+        // A byte goes out on a Timer2 tick at the earliest, the pacing only
+        // shows where it needs more than one tick; a sync build times it alone
+        printf("LCD async, whole %u us queue ticks per byte:\n", LCD_ASYNC_PERIOD_US);
+    } else {
+        printf("LCD sync, pacing and pin writes per byte:\n");
+    }
+    for (uint8_t mode = 0; mode < 2; mode++) {
+        if (lcd_set_write_only(mode)) lcd_measure();
+    }
+    lcd_set_write_only(configured);
+    printf("  dropped %u\n", lcd_dropped());
 
-	sei();                    // Enable global interrupts
-}
- 
- /* Interrupt Service Routine for Emergency Button */
-ISR(INT3_vect) {
-    emergencyActivated = 1;
-    state = EMERGENCY;
-    TWI_send_message(build_message(SPEAKER_STOP));  // Stop the melody
+    lcdbuf_invalidate(); // redraw the framebuffer
 }
 
 // Setup the stream functions for UART, read  https://appelsiini.net/2011/simple-usart-with-avr-libc/
@@ -187,11 +699,14 @@ FILE uart_input = FDEV_SETUP_STREAM(NULL, USART_getchar, _FDEV_SETUP_READ);
 
 /* Main loop */
 int main(void) {
+    SYSTICK_init();
+    MOTION_init(currentFloor);
+    TRAFFIC_init();
     setup();
-    init_emergency_interrupt(); // Initialize emergency interrupt
 
     /* Initialize coms */
     USART_init(9600);     // For debug printf FIRST
+    IDLE_init();          // Power down unused peripherals
 
     // redirect the stdin and stdout to UART functions
     stdout = &uart_output;
@@ -202,58 +717,60 @@ int main(void) {
     // Initialize TWI after USART is ready for debug prints
     TWI_init_master(TWI_FREQ); // 400kHz TWI
 
+    // Enters IDLE; the emergency callback posts into the machine
+    HSM_init(&elevator, elevator_states, ST_COUNT,
+             elevator_transitions, sizeof(elevator_transitions) / sizeof(elevator_transitions[0]),
+             elevator_stats, ST_NORMAL);
+
+    // The emergency path sends over TWI, so arm it after the bus is up
+    EMERGENCY_init(on_emergency_latch);
+
     printf("System initialized - TWI frequency: ");
     USART_print_binary(TWI_FREQ, 32);
     printf("\n");
     
     /* Main Loop */
     while (1) {
-		lcd_clrscr();
-
-	    char lcd_text[17];
-		sprintf(lcd_text,"Floor:%02d Sel:%02d",currentFloor,selectedFloor);
-		lcd_puts(lcd_text);
-		
-        switch (state) {
-            case IDLE:
-                //lcd_gotoxy(11,0);
-                
-                selectedFloor = requestFloorFromKeypad(selectedFloor);
-                if (emergencyActivated)break;
-                if (selectedFloor == currentFloor) {
-                    state = FAULT;
-                } else {
-                    state = MOVING;
-                }
-                break;
-
-            case MOVING:
-                go_to_floor(selectedFloor);
-                if (!emergencyActivated) {
-                    state = DOOR_OPEN;
-                }
-                break;
-
-            case DOOR_OPEN:
-                door_sequence();
-                state = IDLE;
-                selectedFloor = currentFloor;
-                break;
-
-            case EMERGENCY:
-                handle_emergency();
-                break;
-
-            case FAULT:
-                lcd_clrscr();
-                lcd_puts("Same Floor Error");
-
-                TWI_send_message(build_message(LED_MOVING_BLINK)); // Send message to UNO
-
-                // CALL UNO: blink_led(&MOVEMENT_LED_PORT, MOVEMENT_LED_PIN, 3, 300);
-                _delay_ms(1000); // Simulate error indication
-                state = IDLE;
-                break;
+        // An emergency stop frame posted by the INT3 interrupt
+        TWI_flush_urgent();
+
+        // Console commands: 'e' emergency stop latency, 's' sleep ratio, 'k' keypad ghost scans,
+        // 'u' + slot melody upload
+        if (USART_data_available()) {
+            switch (USART_receive()) {
+                case 'e': EMERGENCY_report(); break;
+                case 's': IDLE_report(); break;
+                case 'p': TRAFFIC_report(); break;
+                case 't': set_clock_from_console(); break;
+                case 'm': HSM_report(&elevator); break;
+                case 'l': lcd_benchmark(); break;
+                case 'k': printf("Keypad scans skipped for ghost keys: %u\n", KEYPAD_GetGhostCount()); break;
+                case 'u': upload_sound_from_console(); break;
+            }
+        }
+
+        // The safety event must not be lost to a queue full of keys:
+        // retry it before any new key is posted
+        if (emergency_unposted && HSM_post(&elevator, EV_EMERGENCY, 0)) {
+            emergency_unposted = false;
+        }
+
+        KEYPAD_Event_st key;
+        while (KEYPAD_GetEvent(&key)) {
+            if (key.pressed) HSM_post(&elevator, EV_KEY, key.key);
+        }
+
+        if (HSM_is_in(&elevator, ST_MOVING)) {
+            update_travel();
+        }
+
+        HSM_process(&elevator);
+        update_landings();
+        lcdmarq_poll();     // one shift command per step
+        lcdbuf_flush();     // only the characters that changed, one display per pass
+
+        if (HSM_is_idle(&elevator)) {
+            IDLE_sleep(false); // nothing to do until the next tick
         }
     }
 }
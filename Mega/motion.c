@@ -0,0 +1,253 @@
+/*
+ * motion.c
+ *
+ * Kinematic model of the car: trapezoidal velocity profile in fixed-point
+ * arithmetic, stepped on every system tick.
+ *
+ * Internal units:
+ *   position      micrometres (um), int32
+ *   velocity      um per tick, Q8 fixed point (x256)
+ *   acceleration  um per tick per tick, Q8 fixed point (x256)
+ *
+ * The profile is produced by a per-tick rule rather than a precomputed
+ * plan: accelerate while below rated speed, cruise, and start braking as
+ * soon as the braking distance reaches the remaining distance. A new stop
+ * therefore only has to move the target; the car decelerates for it on its
+ * own, and both trapezoidal and triangular (short trip) profiles fall out.
+ */
+
+#include "motion.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// Common includes
+#include "systick.h"
+
+#define FLOOR_UM   ((int32_t)MOTION_FLOOR_HEIGHT_MM * 1000L)
+
+// mm/s is um/ms, one tick is SYSTICK_US_PER_TICK us
+#define SPEED_Q8(mm_s)  ((int32_t)((uint32_t)(mm_s) * SYSTICK_US_PER_TICK * 256UL / 1000UL))
+#define VMAX_Q8         SPEED_Q8(MOTION_MAX_SPEED_MM_S)
+#define CREEP_Q8        SPEED_Q8(MOTION_CREEP_SPEED_MM_S)
+#define ACCEL_Q8        ((int32_t)((uint64_t)MOTION_ACCEL_MM_S2 * SYSTICK_US_PER_TICK * SYSTICK_US_PER_TICK * 256ULL / 1000000000ULL))
+
+#define ABS32(x)   ((x) < 0 ? -(x) : (x))
+
+static volatile int32_t pos_um = 0;
+static volatile int32_t vel_q8 = 0;
+static volatile int32_t target_um = 0;
+static volatile bool moving = false;
+static int32_t pos_frac = 0;   // sub-micrometre remainder, tick context only
+static uint8_t target_floor = 0;
+
+// Distance needed to brake from a speed (Q8 um/tick) to a halt, in um
+static int32_t braking_distance_um(int32_t speed_q8) {
+    int32_t v = speed_q8 >> 8;
+    // v^2 / (2a) with a in Q8, plus one step of margin for the discrete steps
+    return (v * v * 128L) / ACCEL_Q8 + v;
+}
+
+static uint32_t isqrt32(uint32_t n) {
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > n) bit >>= 2;
+    while (bit != 0) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+// Time in ms to cover d mm starting at v0 mm/s in the direction of travel
+// and stop at the end
+static uint32_t trip_time_ms(uint32_t d, uint32_t v0) {
+    const uint32_t vmax = MOTION_MAX_SPEED_MM_S;
+    const uint32_t a = MOTION_ACCEL_MM_S2;
+
+    if (d == 0) return 0;
+
+    uint32_t d_acc = (v0 < vmax) ? (vmax * vmax - v0 * v0) / (2 * a) : 0;
+    uint32_t d_dec = (vmax * vmax) / (2 * a);
+
+    if (d >= d_acc + d_dec) {
+        // Trapezoid: accelerate, cruise, brake
+        return ((vmax - v0) * 1000UL) / a
+             + ((d - d_acc - d_dec) * 1000UL) / vmax
+             + (vmax * 1000UL) / a;
+    }
+
+    // Triangle: peak speed where acceleration meets braking
+    uint32_t vp = isqrt32((2 * a * d + v0 * v0) / 2);
+    if (vp <= v0) {
+        // Already inside the braking distance: brake all the way
+        return (2 * d * 1000UL) / v0;
+    }
+    return ((vp - v0) * 1000UL) / a + (vp * 1000UL) / a;
+}
+
+// Runs on every system tick: one step of the velocity profile
+static void motion_tick(void) {
+    if (!moving) return;
+
+    int32_t remaining = target_um - pos_um;
+    int32_t speed = ABS32(vel_q8);
+    bool toward = (vel_q8 == 0) || ((vel_q8 > 0) == (remaining > 0));
+
+    if (!toward) {
+        // Moving away from the target: brake to a halt first
+        speed -= ACCEL_Q8;
+        if (speed < 0) speed = 0;
+    } else if (braking_distance_um(speed) >= ABS32(remaining)) {
+        speed -= ACCEL_Q8;
+        if (speed < CREEP_Q8) speed = CREEP_Q8;
+    } else if (speed < VMAX_Q8) {
+        speed += ACCEL_Q8;
+        if (speed > VMAX_Q8) speed = VMAX_Q8;
+    }
+
+    bool up = toward ? (remaining >= 0) : (vel_q8 > 0);
+    vel_q8 = up ? speed : -speed;
+
+    // Advance, carrying the sub-micrometre fraction to the next tick
+    int32_t step = vel_q8 + pos_frac;
+    int32_t step_um = step >> 8;
+    pos_frac = step - (step_um << 8);
+
+    if (toward && ABS32(step_um) >= ABS32(remaining)) {
+        // Arrived: settle exactly on the target
+        pos_um = target_um;
+        vel_q8 = 0;
+        pos_frac = 0;
+        moving = false;
+        return;
+    }
+
+    pos_um += step_um;
+}
+
+void MOTION_init(uint8_t floor) {
+    uint8_t sreg = SREG;
+    cli();
+    pos_um = (int32_t)floor * FLOOR_UM;
+    target_um = pos_um;
+    vel_q8 = 0;
+    pos_frac = 0;
+    moving = false;
+    target_floor = floor;
+    SREG = sreg;
+
+    SYSTICK_add_callback(motion_tick);
+}
+
+bool MOTION_can_stop_at(uint8_t floor) {
+    int32_t target = (int32_t)floor * FLOOR_UM;
+
+    uint8_t sreg = SREG;
+    cli();
+    int32_t pos = pos_um;
+    int32_t vel = vel_q8;
+    bool in_motion = moving;
+    SREG = sreg;
+
+    if (!in_motion || vel == 0) return true;
+
+    int32_t remaining = target - pos;
+    if (remaining == 0 || (vel > 0) != (remaining > 0)) {
+        return false; // at or behind the car
+    }
+
+    return braking_distance_um(ABS32(vel)) < ABS32(remaining);
+}
+
+bool MOTION_go_to(uint8_t floor) {
+    if (!MOTION_can_stop_at(floor)) {
+        return false;
+    }
+
+    uint8_t sreg = SREG;
+    cli();
+    target_um = (int32_t)floor * FLOOR_UM;
+    target_floor = floor;
+    moving = (pos_um != target_um) || (vel_q8 != 0);
+    SREG = sreg;
+
+    return true;
+}
+
+void MOTION_emergency_stop(void) {
+    uint8_t sreg = SREG;
+    cli();
+    vel_q8 = 0;
+    pos_frac = 0;
+    target_um = pos_um;
+    moving = false;
+    SREG = sreg;
+}
+
+bool MOTION_is_moving(void) {
+    return moving;
+}
+
+bool MOTION_is_at_floor(uint8_t floor) {
+    uint8_t sreg = SREG;
+    cli();
+    bool at_floor = !moving && pos_um == (int32_t)floor * FLOOR_UM;
+    SREG = sreg;
+
+    return at_floor;
+}
+
+int32_t MOTION_position_mm(void) {
+    uint8_t sreg = SREG;
+    cli();
+    int32_t pos = pos_um;
+    SREG = sreg;
+
+    return pos / 1000;
+}
+
+int16_t MOTION_velocity_mm_s(void) {
+    uint8_t sreg = SREG;
+    cli();
+    int32_t vel = vel_q8;
+    SREG = sreg;
+
+    return (int16_t)((vel * 1000L) / (SYSTICK_US_PER_TICK * 256L));
+}
+
+uint8_t MOTION_current_floor(void) {
+    uint8_t sreg = SREG;
+    cli();
+    int32_t pos = pos_um;
+    SREG = sreg;
+
+    if (pos <= 0) return 0;
+    return (uint8_t)((pos + FLOOR_UM / 2) / FLOOR_UM);
+}
+
+uint8_t MOTION_target_floor(void) {
+    return target_floor;
+}
+
+uint32_t MOTION_eta_ms(uint8_t floor) {
+    int32_t pos = MOTION_position_mm();
+    int32_t vel = MOTION_velocity_mm_s();
+    int32_t remaining = (int32_t)floor * MOTION_FLOOR_HEIGHT_MM - pos;
+    uint32_t v0 = ABS32(vel);
+
+    if (v0 != 0 && (vel > 0) != (remaining > 0)) {
+        // Floor is behind the car: brake to a halt, then travel back
+        uint32_t t_stop = (v0 * 1000UL) / MOTION_ACCEL_MM_S2;
+        uint32_t d_stop = (v0 * v0) / (2UL * MOTION_ACCEL_MM_S2);
+        return t_stop + trip_time_ms(ABS32(remaining) + d_stop, 0);
+    }
+
+    return trip_time_ms(ABS32(remaining), v0);
+}
@@ -0,0 +1,102 @@
+/*
+ * motion.h
+ *
+ * Kinematic model of the car: trapezoidal velocity profile in fixed-point
+ * arithmetic, stepped on every system tick. Position is tracked at
+ * micrometre resolution internally and exposed in millimetres.
+ */
+
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Car and shaft parameters */
+#define MOTION_FLOOR_HEIGHT_MM   3000   // distance between two landings
+#define MOTION_MAX_SPEED_MM_S    1000   // rated speed
+#define MOTION_ACCEL_MM_S2        500   // acceleration and deceleration
+#define MOTION_CREEP_SPEED_MM_S    20   // minimum speed during final approach
+
+/**
+ * @brief Initialize the motion model with the car standing at a floor
+ * @param floor Floor the car is standing at
+ *
+ * Registers the motion update with the system tick, requires SYSTICK_init().
+ */
+void MOTION_init(uint8_t floor);
+
+/**
+ * @brief Plan a trip to a floor, or re-plan the current trip
+ * @param floor Destination floor
+ * @return true if the plan was accepted, false if the car is moving and
+ *         can no longer stop at the floor (too close, or behind the car)
+ *
+ * While moving, a new stop on the way is accepted as long as the braking
+ * distance allows it; the car then decelerates for the new stop.
+ */
+bool MOTION_go_to(uint8_t floor);
+
+/**
+ * @brief Check if the car could still stop at a floor
+ * @param floor Candidate floor
+ * @return true if MOTION_go_to(floor) would be accepted
+ */
+bool MOTION_can_stop_at(uint8_t floor);
+
+/**
+ * @brief Halt the car immediately at its current position
+ *
+ * Safe to call from interrupt context. The car may end up between floors.
+ */
+void MOTION_emergency_stop(void);
+
+/**
+ * @brief Check if the car is moving
+ * @return true while a trip is in progress
+ */
+bool MOTION_is_moving(void);
+
+/**
+ * @brief Check if the car is standing level with a floor
+ * @param floor Floor to check
+ * @return true if stopped exactly at the floor
+ */
+bool MOTION_is_at_floor(uint8_t floor);
+
+/**
+ * @brief Get the car position
+ * @return Position above floor 0 in millimetres
+ */
+int32_t MOTION_position_mm(void);
+
+/**
+ * @brief Get the car velocity
+ * @return Velocity in mm/s, positive when moving up
+ */
+int16_t MOTION_velocity_mm_s(void);
+
+/**
+ * @brief Get the floor nearest to the car
+ * @return Floor number
+ */
+uint8_t MOTION_current_floor(void);
+
+/**
+ * @brief Get the destination of the current or last trip
+ * @return Floor number
+ */
+uint8_t MOTION_target_floor(void);
+
+/**
+ * @brief Estimate the time to stop at a floor from the current state
+ * @param floor Destination floor
+ * @return Estimated time in milliseconds, 0 if already there
+ *
+ * Accounts for the current velocity, including braking to a halt first
+ * if the floor is behind the car. Intended as the travel-time term of
+ * dispatching cost functions and for the ETA shown on the LCD.
+ */
+uint32_t MOTION_eta_ms(uint8_t floor);
+
+#endif
@@ -23,6 +23,13 @@
 #define LCD_E_PORT              PORTB           /**< port for Enable line     */
 #define LCD_E_PIN               5               /**< pin  for Enable line     */
 
+// Landing indicators share the data, RS and RW lines of the car display
+#define LCD_DISPLAYS            3               /**< car display and two landings */
+#define LCD_E1_PORT             PORTL           /**< Enable line of display 1 */
+#define LCD_E1_PIN              0               /**< pin for Enable line of display 1 */
+#define LCD_E2_PORT             PORTL           /**< Enable line of display 2 */
+#define LCD_E2_PIN              1               /**< pin for Enable line of display 2 */
+
 #define M_RowColDirection       DDRK            //PORT Direction Configuration for keypad
 #define M_ROW                   PORTK           //Higher four bits of PORT are used as ROWs
 #define M_COL                   PINK            //Lower four bits of PORT are used as COLs
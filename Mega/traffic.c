@@ -0,0 +1,189 @@
+/*
+ * traffic.c
+ *
+ * Traffic statistics: per-floor, per-time-slot call histograms kept in RAM
+ * and checkpointed to EEPROM, used to park an idle car at the floor with
+ * the highest predicted demand.
+ *
+ * Counters are 8 bits. When one saturates, every counter of that time slot
+ * is halved, so the histogram keeps its shape and slowly forgets old
+ * traffic. The checkpoint is written one byte per system tick with
+ * eeprom_update_byte(), which skips bytes that did not change: the main
+ * loop never waits for the EEPROM and unchanged cells are not worn. Each
+ * time slot is copied when its first byte is written, so a call recorded
+ * meanwhile never leaves a half-aged slot in the EEPROM.
+ *
+ * The time of day is a minutes counter advanced by the system tick, so it
+ * does not jump when the millisecond counter wraps after 49.7 days.
+ */
+
+#include "traffic.h"
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <stdio.h>
+#include <string.h>
+
+// Common includes
+#include "systick.h"
+
+#define TRAFFIC_MAGIC  0xA5
+#define MINUTES_PER_DAY (24U * 60U)
+
+// EEPROM image: the magic byte is written last, so an interrupted first
+// checkpoint is never mistaken for valid data
+typedef struct {
+    uint8_t counts[TRAFFIC_SLOTS][TRAFFIC_FLOORS];
+    uint8_t slots;
+    uint8_t floors;
+    uint8_t magic;
+} TrafficCheckpoint;
+
+static TrafficCheckpoint EEMEM ee_checkpoint;
+
+static uint8_t counts[TRAFFIC_SLOTS][TRAFFIC_FLOORS];
+
+// Time of day, advanced from the system tick
+static volatile uint16_t clock_minutes = 0;
+static uint32_t minute_start_ms = 0;
+
+// Checkpoint state, advanced from the system tick
+static volatile bool dirty = false;
+static volatile bool checkpoint_active = false;
+static uint16_t checkpoint_index = 0;
+static uint32_t last_checkpoint_ms = 0;
+static uint8_t checkpoint_slot[TRAFFIC_FLOORS];  // copy of the slot being written
+
+// Runs on every system tick: keeps the time of day and writes at most one
+// checkpoint byte
+static void traffic_tick(void) {
+    uint32_t now = SYSTICK_millis();
+    if (now - minute_start_ms >= 60000UL) {
+        minute_start_ms += 60000UL;
+        clock_minutes = (clock_minutes + 1) % MINUTES_PER_DAY;
+    }
+
+    if (!checkpoint_active) {
+        if (dirty && (now - last_checkpoint_ms >= TRAFFIC_CHECKPOINT_MS)) {
+            dirty = false;
+            checkpoint_index = 0;
+            checkpoint_active = true;
+        }
+        return;
+    }
+
+    if (!eeprom_is_ready()) {
+        return; // previous byte still being programmed
+    }
+
+    if (checkpoint_index < sizeof(counts)) {
+        uint8_t slot = checkpoint_index / TRAFFIC_FLOORS;
+        uint8_t floor = checkpoint_index % TRAFFIC_FLOORS;
+        if (floor == 0) {
+            memcpy(checkpoint_slot, counts[slot], TRAFFIC_FLOORS);
+        }
+        eeprom_update_byte(&ee_checkpoint.counts[slot][floor], checkpoint_slot[floor]);
+        checkpoint_index++;
+    } else if (checkpoint_index == sizeof(counts)) {
+        eeprom_update_byte(&ee_checkpoint.slots, TRAFFIC_SLOTS);
+        checkpoint_index++;
+    } else if (checkpoint_index == sizeof(counts) + 1) {
+        eeprom_update_byte(&ee_checkpoint.floors, TRAFFIC_FLOORS);
+        checkpoint_index++;
+    } else {
+        eeprom_update_byte(&ee_checkpoint.magic, TRAFFIC_MAGIC);
+        checkpoint_active = false;
+        last_checkpoint_ms = now;
+    }
+}
+
+void TRAFFIC_init(void) {
+    // A checkpoint is only valid if it was written with the same layout
+    if (eeprom_read_byte(&ee_checkpoint.magic) == TRAFFIC_MAGIC &&
+        eeprom_read_byte(&ee_checkpoint.slots) == TRAFFIC_SLOTS &&
+        eeprom_read_byte(&ee_checkpoint.floors) == TRAFFIC_FLOORS) {
+        eeprom_read_block(counts, ee_checkpoint.counts, sizeof(counts));
+    } else {
+        memset(counts, 0, sizeof(counts));
+    }
+
+    minute_start_ms = SYSTICK_millis();
+    last_checkpoint_ms = minute_start_ms;
+
+    SYSTICK_add_callback(traffic_tick);
+}
+
+void TRAFFIC_set_clock(uint16_t minutes) {
+    uint8_t sreg = SREG;
+    cli();
+    clock_minutes = minutes % MINUTES_PER_DAY;
+    minute_start_ms = SYSTICK_millis();
+    SREG = sreg;
+}
+
+uint16_t TRAFFIC_clock(void) {
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t minutes = clock_minutes;
+    SREG = sreg;
+    return minutes;
+}
+
+void TRAFFIC_record_call(uint8_t floor) {
+    if (floor >= TRAFFIC_FLOORS) return;
+
+    uint8_t slot = TRAFFIC_clock() / TRAFFIC_SLOT_MINUTES;
+
+    // The checkpoint copies the slot from the tick interrupt
+    uint8_t sreg = SREG;
+    cli();
+    if (counts[slot][floor] == UINT8_MAX) {
+        // Age the whole slot so the relative demand is kept
+        for (uint8_t f = 0; f < TRAFFIC_FLOORS; f++) {
+            counts[slot][f] >>= 1;
+        }
+    }
+    counts[slot][floor]++;
+    dirty = true;
+    SREG = sreg;
+}
+
+uint8_t TRAFFIC_predict_floor(void) {
+    uint8_t slot = TRAFFIC_clock() / TRAFFIC_SLOT_MINUTES;
+    uint8_t next = (slot + 1) % TRAFFIC_SLOTS;
+
+    uint8_t best_floor = TRAFFIC_NO_FLOOR;
+    uint16_t best_score = 0;
+
+    for (uint8_t f = 0; f < TRAFFIC_FLOORS; f++) {
+        uint16_t score = 2 * (uint16_t)counts[slot][f] + counts[next][f];
+        if (score > best_score) {
+            best_score = score;
+            best_floor = f;
+        }
+    }
+
+    return best_floor;
+}
+
+void TRAFFIC_report(void) {
+    uint16_t now = TRAFFIC_clock();
+    printf("Time %02u:%02u, park floor: %u\n", now / 60, now % 60, TRAFFIC_predict_floor());
+
+    for (uint8_t slot = 0; slot < TRAFFIC_SLOTS; slot++) {
+        uint8_t busiest = 0;
+        uint16_t total = 0;
+
+        for (uint8_t f = 0; f < TRAFFIC_FLOORS; f++) {
+            total += counts[slot][f];
+            if (counts[slot][f] > counts[slot][busiest]) {
+                busiest = f;
+            }
+        }
+
+        uint16_t start = slot * TRAFFIC_SLOT_MINUTES;
+        printf("%02u:%02u calls: %u, busiest floor: %u\n",
+               start / 60, start % 60, total, busiest);
+    }
+}
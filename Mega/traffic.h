@@ -0,0 +1,66 @@
+/*
+ * traffic.h
+ *
+ * Traffic statistics: per-floor, per-time-slot call histograms kept in RAM
+ * and checkpointed to EEPROM, used to park an idle car at the floor with
+ * the highest predicted demand.
+ */
+
+#ifndef TRAFFIC_H
+#define TRAFFIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRAFFIC_FLOORS            100      // floors 0-99 can be selected on the keypad
+#define TRAFFIC_SLOTS              12      // time-of-day slots
+#define TRAFFIC_SLOT_MINUTES      (24 * 60 / TRAFFIC_SLOTS)
+#define TRAFFIC_CHECKPOINT_MS     (15UL * 60UL * 1000UL)  // EEPROM checkpoint interval
+#define TRAFFIC_PARK_DELAY_MS     (60UL * 1000UL)         // idle time before parking
+
+#define TRAFFIC_NO_FLOOR          0xFF
+
+/**
+ * @brief Load the histograms from EEPROM and start the checkpoint timer
+ *
+ * Starts with empty histograms if the EEPROM holds no valid checkpoint.
+ * Requires SYSTICK_init().
+ */
+void TRAFFIC_init(void);
+
+/**
+ * @brief Set the time of day
+ * @param minutes Minutes since midnight
+ *
+ * The board has no real-time clock; the time of day is kept by the system
+ * tick from this reference point (midnight at power-on by default).
+ */
+void TRAFFIC_set_clock(uint16_t minutes);
+
+/**
+ * @brief Get the time of day
+ * @return Minutes since midnight
+ */
+uint16_t TRAFFIC_clock(void);
+
+/**
+ * @brief Record a passenger call
+ * @param floor Floor the passenger boarded at
+ */
+void TRAFFIC_record_call(uint8_t floor);
+
+/**
+ * @brief Get the floor with the highest predicted demand right now
+ * @return Floor number, or TRAFFIC_NO_FLOOR if there is no history yet
+ *
+ * Weighs the current time slot double and the next slot single, so the
+ * car moves ahead of an approaching peak.
+ */
+uint8_t TRAFFIC_predict_floor(void);
+
+/**
+ * @brief Print the busiest floor of every time slot to the debug console
+ */
+void TRAFFIC_report(void);
+
+#endif
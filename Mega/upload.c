@@ -0,0 +1,56 @@
+/*
+ * upload.c
+ *
+ * Melody upload to the UNO, one image byte per TWI frame
+ */
+
+#include "upload.h"
+
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+
+// Common includes
+#include "message.h"
+#include "twi.h"
+
+typedef struct {
+    uint16_t crc;
+    uint8_t offset;
+    uint8_t status;
+} UploadStream;
+
+static void send_byte(UploadStream *stream, uint8_t data, bool checked) {
+    if (stream->status != 0) return;
+
+    if (checked) {
+        stream->crc = _crc_ccitt_update(stream->crc, data);
+    }
+    stream->status = TWI_send_message_quiet(build_message_upload(UPLOAD_DATA, data, stream->offset++));
+}
+
+uint8_t UPLOAD_send_sound(uint8_t slot, uint8_t tempo, uint8_t flags, uint8_t priority,
+                          const uint8_t *melody, uint8_t length) {
+    uint16_t size = UPLOAD_HEADER_SIZE + length + UPLOAD_CRC_SIZE;
+    if (size > UPLOAD_MAX_SIZE) return 0xFF;
+
+    UploadStream stream = { UPLOAD_CRC_INIT, 0, 0 };
+
+    stream.status = TWI_send_message_quiet(build_message_upload(UPLOAD_BEGIN, slot, size));
+
+    send_byte(&stream, tempo, true);
+    send_byte(&stream, flags, true);
+    send_byte(&stream, priority, true);
+    for (uint8_t i = 0; i < length; i++) {
+        send_byte(&stream, pgm_read_byte(&melody[i]), true);
+    }
+
+    uint16_t crc = stream.crc;
+    send_byte(&stream, crc >> 8, false);
+    send_byte(&stream, crc & 0xFF, false);
+
+    if (stream.status != 0) {
+        TWI_send_message_quiet(build_message_upload(UPLOAD_ABORT, 0, 0));
+        return stream.status;
+    }
+    return TWI_send_message_quiet(build_message_upload(UPLOAD_COMMIT, slot, 0));
+}
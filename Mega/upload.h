@@ -0,0 +1,30 @@
+/*
+ * upload.h
+ *
+ * Melody upload to the UNO: streams a sound image over TWI in SOUND_UPLOAD
+ * frames (see message.h). The UNO checks the CRC, keeps the sound in an
+ * EEPROM slot and plays it as sound ID 16 + slot.
+ */
+
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <stdint.h>
+
+/**
+ * @brief Upload a sound to an UNO slot
+ * @param slot UNO slot, 0-1
+ * @param tempo Beats per minute
+ * @param flags UPLOAD_REPEAT or 0
+ * @param priority 0 background, 1 chime, 2 emergency
+ * @param melody Melody bytes in PROGMEM, format in Uno/Buzzer.h
+ * @param length Melody bytes, up to UPLOAD_MAX_SIZE minus the header and CRC
+ * @return 0 on success, else the TWI error code or 0xFF if too long
+ *
+ * Blocks for one TWI frame per byte, without debug output. An upload cut
+ * short by a TWI error is aborted, the slot keeps its old sound.
+ */
+uint8_t UPLOAD_send_sound(uint8_t slot, uint8_t tempo, uint8_t flags, uint8_t priority,
+                          const uint8_t *melody, uint8_t length);
+
+#endif
@@ -17,759 +17,1031 @@
 #include "pins.h"
 #include "Buzzer.h"
 #include "notes.h"
+#include "upload.h"
 
 #include <stdbool.h>
-#include <stdlib.h> // For abs()
+#include <stddef.h>
+#include <string.h>
 #include <avr/pgmspace.h> // PROGMEM support
 
+// Read position in a melody or segment
+typedef struct {
+	const uint8_t* pos;		// next byte
+	const uint8_t* end;		// end of the data, read as MELODY_END
+	const uint8_t* mark;	// start of the part to repeat
+	uint8_t base;			// pitch of note code 1
+	uint8_t repeats_left;
+	bool repeating;
+	bool ram;				// data in RAM (uploaded), else PROGMEM
+} MelodyFrame;
+
+// Note lengths of the current melody, by duration code
+typedef struct {
+	uint16_t ticks;
+	uint16_t gate;
+} NoteLength;
+
+// Player state of one voice
+typedef struct {
+	MelodyFrame frames[2];	// track, segment
+	uint8_t depth;
+	const uint8_t* track;	// start of the track, for repeats
+	uint16_t length;
+	bool ram;				// track in RAM
+	Note note;				// decoded note being played
+	uint16_t countdown;		// sequencer ticks to the gate or the note end
+	bool sounding;			// before the gate of note
+	bool active;			// false once the track has ended
+} Voice;
+
 // Melody state variables
-bool melody_playing = false;
+volatile bool melody_playing = false;
 bool repeat_melody = false;
-const Note* current_melody;
-uint16_t melody_length;
-uint16_t current_note_index = 0;
-uint16_t current_duration_count = 0;
-uint32_t current_note_duration_ms = 0;
-uint16_t current_tempo = 120;
-
-// Convert note frequency to timer value
-uint16_t frequencyToTimerValue(uint16_t frequency) {
-	if (frequency == 0) return 0; // For rests/pauses
-	
-	// For AVR timers in CTC mode, the formula is:
-	// OCR value = (F_CPU / (2 * desired frequency)) - 1
-	uint32_t calculated_ocr = (F_CPU / (2UL * frequency)) - 1;
-	
-	// Ensure value fits in 16-bit timer
-	if (calculated_ocr > 65535) calculated_ocr = 65535;
-	
-	return (uint16_t)calculated_ocr;
-}
+bool two_voices = false;	// harmony on OC1B, Timer1 in normal mode
+Voice voices[MELODY_VOICES];	// lead on OC1A, harmony on OC1B
+NoteLength note_lengths[MELODY_DURATIONS];
+uint16_t note_whole_ticks = 0;	// whole note the lengths are for
+uint16_t scheduled_ticks;	// sequencer ticks programmed into OCR2A, 1-256
+volatile uint16_t tone_period[MELODY_VOICES];	// two-voice mode, in Timer1 counts
+BuzzerStats buzzer_stats;
 
-// Calculate note duration in milliseconds based on tempo
-uint32_t calculateNoteDuration(int8_t duration, uint16_t tempo) {
-	uint32_t wholenote = (60000UL * 4) / tempo;
-	uint32_t ms;
-	
-	if (duration > 0) {
-		// Regular note duration
-		ms = wholenote / duration;
-	} else if (duration < 0) {
-		// Dotted note (1.5x duration)
-		ms = wholenote / abs(duration);
-		ms *= 1.5;
-	} else {
-		// Should never happen, but default to quarter note
-		ms = wholenote / 4;
-	}
-	
-	return ms;
-}
+// A sound waiting to resume, with the position it was stopped at
+typedef struct {
+	uint8_t sound_id;
+	bool restart;			// not played yet, starts from the beginning
+	bool repeat;
+	bool two_voices;
+	Voice voices[MELODY_VOICES];
+} SavedSound;
+
+// Sound scheduler state
+uint8_t current_sound;			// valid while melody_playing
+uint8_t current_priority;
+uint8_t sound_queue[SOUND_QUEUE_SIZE];	// chimes waiting, oldest first
+uint8_t queue_head = 0;
+uint8_t queue_count = 0;
+SavedSound suspended;			// background sound to resume
+bool has_suspended = false;
+
+// Timer1 compare value of every pitch, computed by the compiler
+#define PITCH_OCR(name) TONE_OCR(NOTE_##name),
+static const uint16_t pitch_ocr[PITCH_COUNT] PROGMEM = {
+	PITCH_LIST(PITCH_OCR)
+};
+
+// Melodies are written with these macros, see the format in Buzzer.h. Each
+// table defines MELODY_BASE; pitches outside of base .. base + 29 and note
+// lengths without a code give an overflow warning.
+#define N(pitch, dur)	MELODY_BYTE((PITCH_##pitch - MELODY_BASE) >= 0 && (PITCH_##pitch - MELODY_BASE) < 30 \
+							? PITCH_##pitch - MELODY_BASE + 1 : 0x20, DURATION_CODE(dur))
+#define R(dur)			MELODY_BYTE(0, DURATION_CODE(dur))
+#define LONG			MELODY_BYTE(MELODY_OPCODE, MELODY_LONG)
+#define MARK			MELODY_BYTE(MELODY_OPCODE, MELODY_MARK)
+#define REPEAT(count)	MELODY_BYTE(MELODY_OPCODE, MELODY_REPEAT), (count)
+#define CALL(segment)	MELODY_BYTE(MELODY_OPCODE, MELODY_CALL), (segment)
+#define END				MELODY_BYTE(MELODY_OPCODE, MELODY_END)
+
+// Segments, parts shared by several places of a melody
+enum {
+	SEGMENT_DOOM_RIFF_E,
+	SEGMENT_DOOM_RIFF_A,
+	SEGMENT_DOOM_ARPEGGIO_E,
+	SEGMENT_COUNT
+};
 
 // Harry Potter Theme (Hedwig's Theme) melody
-const Note harry_potter_melody[] PROGMEM = {
-	{REST, HALF},
-	{NOTE_D4, QUARTER},
-	{NOTE_G4, DOTTED_QUARTER},
-	{NOTE_AS4, EIGHTH},
-	{NOTE_A4, QUARTER},
-	{NOTE_G4, HALF},
-	{NOTE_D5, QUARTER},
-	{NOTE_C5, DOTTED_HALF},
-	{NOTE_A4, DOTTED_HALF},
-	{NOTE_G4, DOTTED_QUARTER},
-	{NOTE_AS4, EIGHTH},
-	{NOTE_A4, QUARTER},
-	{NOTE_F4, HALF},
-	{NOTE_GS4, QUARTER},
-	{NOTE_D4, DOTTED_WHOLE},
-	{NOTE_D4, QUARTER},
+#define MELODY_BASE PITCH_CS4
+const uint8_t harry_potter_melody[] PROGMEM = {
+	MELODY_BASE,
+	R(HALF),
+	N(D4, QUARTER),
+	N(G4, DOTTED_QUARTER),
+	N(AS4, EIGHTH),
+	N(A4, QUARTER),
+	N(G4, HALF),
+	N(D5, QUARTER),
+	N(C5, DOTTED_HALF),
+	N(A4, DOTTED_HALF),
+	N(G4, DOTTED_QUARTER),
+	N(AS4, EIGHTH),
+	N(A4, QUARTER),
+	N(F4, HALF),
+	N(GS4, QUARTER),
+	LONG, N(D4, DOTTED_HALF),
+	N(D4, QUARTER),
 
 	// Measure 10
-	{NOTE_G4, DOTTED_QUARTER},
-	{NOTE_AS4, EIGHTH},
-	{NOTE_A4, QUARTER},
-	{NOTE_G4, HALF},
-	{NOTE_D5, QUARTER},
-	{NOTE_F5, HALF},
-	{NOTE_E5, QUARTER},
-	{NOTE_DS5, HALF},
-	{NOTE_B4, QUARTER},
-	{NOTE_DS5, DOTTED_QUARTER},
-	{NOTE_D5, EIGHTH},
-	{NOTE_CS5, QUARTER},
-	{NOTE_CS4, HALF},
-	{NOTE_B4, QUARTER},
-	{NOTE_G4, DOTTED_WHOLE},
-	{NOTE_AS4, QUARTER},
+	N(G4, DOTTED_QUARTER),
+	N(AS4, EIGHTH),
+	N(A4, QUARTER),
+	N(G4, HALF),
+	N(D5, QUARTER),
+	N(F5, HALF),
+	N(E5, QUARTER),
+	N(DS5, HALF),
+	N(B4, QUARTER),
+	N(DS5, DOTTED_QUARTER),
+	N(D5, EIGHTH),
+	N(CS5, QUARTER),
+	N(CS4, HALF),
+	N(B4, QUARTER),
+	LONG, N(G4, DOTTED_HALF),
+	N(AS4, QUARTER),
 
 	// Measure 18
-	{NOTE_D5, HALF},
-	{NOTE_AS4, QUARTER},
-	{NOTE_D5, HALF},
-	{NOTE_AS4, QUARTER},
-	{NOTE_DS5, HALF},
-	{NOTE_D5, QUARTER},
-	{NOTE_CS5, HALF},
-	{NOTE_A4, QUARTER},
-	{NOTE_AS4, DOTTED_QUARTER},
-	{NOTE_D5, EIGHTH},
-	{NOTE_CS5, QUARTER},
-	{NOTE_CS4, HALF},
-	{NOTE_D4, QUARTER},
-	{NOTE_D5, DOTTED_WHOLE},
-	{REST, QUARTER},
-	{NOTE_AS4, QUARTER},
+	N(D5, HALF),
+	N(AS4, QUARTER),
+	N(D5, HALF),
+	N(AS4, QUARTER),
+	N(DS5, HALF),
+	N(D5, QUARTER),
+	N(CS5, HALF),
+	N(A4, QUARTER),
+	N(AS4, DOTTED_QUARTER),
+	N(D5, EIGHTH),
+	N(CS5, QUARTER),
+	N(CS4, HALF),
+	N(D4, QUARTER),
+	LONG, N(D5, DOTTED_HALF),
+	R(QUARTER),
+	N(AS4, QUARTER),
+	END
 };
+#undef MELODY_BASE
 
 // Original basic melodies
-const Note emergency_melody[] PROGMEM = {
-	{NOTE_C5, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{NOTE_G5, EIGHTH},
-	{NOTE_C6, QUARTER},
-	{NOTE_G5, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{NOTE_C5, QUARTER},
-	{REST, EIGHTH}
+#define MELODY_BASE PITCH_C5
+const uint8_t emergency_melody[] PROGMEM = {
+	MELODY_BASE,
+	N(C5, EIGHTH),
+	N(E5, EIGHTH),
+	N(G5, EIGHTH),
+	N(C6, QUARTER),
+	N(G5, EIGHTH),
+	N(E5, EIGHTH),
+	N(C5, QUARTER),
+	R(EIGHTH),
+	END
 };
+#undef MELODY_BASE
 
-const Note door_open_melody[] PROGMEM = {
-	{NOTE_C5, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{NOTE_G5, EIGHTH},
-	{NOTE_C6, QUARTER}
+#define MELODY_BASE PITCH_C5
+const uint8_t door_open_melody[] PROGMEM = {
+	MELODY_BASE,
+	N(C5, EIGHTH),
+	N(E5, EIGHTH),
+	N(G5, EIGHTH),
+	N(C6, QUARTER),
+	END
 };
+#undef MELODY_BASE
 
-const Note door_close_melody[] PROGMEM = {
-	{NOTE_C6, EIGHTH},
-	{NOTE_G5, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{NOTE_C5, QUARTER}
+#define MELODY_BASE PITCH_C5
+const uint8_t door_close_melody[] PROGMEM = {
+	MELODY_BASE,
+	N(C6, EIGHTH),
+	N(G5, EIGHTH),
+	N(E5, EIGHTH),
+	N(C5, QUARTER),
+	END
 };
+#undef MELODY_BASE
 
-const Note nokia_melody[] PROGMEM = {
-	{NOTE_E5, EIGHTH},
-	{NOTE_D5, EIGHTH},
-	{NOTE_FS4, QUARTER},
-	{NOTE_GS4, QUARTER},
-	{NOTE_CS5, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_D4, QUARTER},
-	{NOTE_E4, QUARTER},
-	{NOTE_B4, EIGHTH},
-	{NOTE_A4, EIGHTH},
-	{NOTE_CS4, QUARTER},
-	{NOTE_E4, QUARTER},
-	{NOTE_A4, HALF}
+// Harmony of the door chimes, the next chord tone below the lead
+#define MELODY_BASE PITCH_C4
+const uint8_t door_open_harmony[] PROGMEM = {
+	MELODY_BASE,
+	N(G4, EIGHTH),
+	N(C5, EIGHTH),
+	N(E5, EIGHTH),
+	N(G5, QUARTER),
+	END
 };
 
-const Note never_gon_melody[] PROGMEM = {
-	{NOTE_D5, DOTTED_QUARTER},
-	{NOTE_E5, DOTTED_QUARTER},
-	{NOTE_A4, QUARTER},
-	{NOTE_E5, DOTTED_QUARTER},
-	{NOTE_FS5, DOTTED_QUARTER},
-	{NOTE_A5, SIXTEENTH},
-	{NOTE_G5, SIXTEENTH},
-	{NOTE_FS5, EIGHTH},
-	{NOTE_D5, DOTTED_QUARTER},
-	{NOTE_E5, DOTTED_QUARTER},
-	{NOTE_A4, HALF},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, EIGHTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_D5, DOTTED_QUARTER},
-	{NOTE_E5, DOTTED_QUARTER},
-	{NOTE_A4, QUARTER},
-	{NOTE_E5, DOTTED_QUARTER},
-	{NOTE_FS5, DOTTED_QUARTER},
-	{NOTE_A5, SIXTEENTH},
-	{NOTE_G5, SIXTEENTH},
-	{NOTE_FS5, EIGHTH},
-	{NOTE_D5, DOTTED_QUARTER},
-	{NOTE_E5, DOTTED_QUARTER},
-	{NOTE_A4, HALF},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, EIGHTH},
-	{NOTE_D5, SIXTEENTH},
-	{REST, QUARTER},
-	{NOTE_B4, EIGHTH},
-	{NOTE_CS5, EIGHTH},
-	{NOTE_D5, EIGHTH},
-	{NOTE_D5, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{NOTE_CS5, DOTTED_EIGHTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_A4, HALF},
-	{REST, QUARTER},
-	
-	{REST, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_CS5, EIGHTH},
-	{NOTE_D5, EIGHTH},
-	{NOTE_B4, QUARTER},
-	{NOTE_A4, EIGHTH},
-	{NOTE_A5, EIGHTH},
-	{REST, EIGHTH},
-	{NOTE_A5, EIGHTH},
-	{NOTE_E5, DOTTED_QUARTER},
-	{REST, QUARTER},
-	{NOTE_B4, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_CS5, EIGHTH},
-	{NOTE_D5, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_D5, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{REST, EIGHTH},
-	{REST, EIGHTH},
-	{NOTE_CS5, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_A4, DOTTED_QUARTER},
-	{REST, QUARTER},
-	{REST, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_CS5, EIGHTH},
-	{NOTE_D5, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_A4, QUARTER},
-	{REST, EIGHTH},
-	{NOTE_A5, EIGHTH},
-	{NOTE_A5, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{NOTE_FS5, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{NOTE_D5, EIGHTH},
-	
-	{REST, EIGHTH},
-	{NOTE_A4, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_CS5, EIGHTH},
-	{NOTE_D5, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{REST, EIGHTH},
-	{NOTE_CS5, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_A4, DOTTED_QUARTER},
-	{REST, QUARTER},
-	{NOTE_B4, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_CS5, EIGHTH},
-	{NOTE_D5, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_A4, QUARTER},
-	{REST, EIGHTH},
-	{REST, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{NOTE_FS5, QUARTER},
-	{NOTE_E5, DOTTED_QUARTER},
-	{NOTE_D5, HALF},
-	{NOTE_D5, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{NOTE_FS5, EIGHTH},
-	{NOTE_E5, QUARTER},
-	{NOTE_E5, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{NOTE_FS5, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{NOTE_A4, EIGHTH},
-	{NOTE_A4, QUARTER},
-	
-	{REST, DOTTED_QUARTER},
-	{NOTE_A4, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_CS5, EIGHTH},
-	{NOTE_D5, EIGHTH},
-	{NOTE_B4, EIGHTH},
-	{REST, EIGHTH},
-	{NOTE_E5, EIGHTH},
-	{NOTE_FS5, EIGHTH},
-	{NOTE_E5, DOTTED_QUARTER},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_FS5, DOTTED_EIGHTH},
-	{NOTE_FS5, DOTTED_EIGHTH},
-	{NOTE_E5, DOTTED_QUARTER},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_E5, DOTTED_EIGHTH},
-	{NOTE_E5, DOTTED_EIGHTH},
-	{NOTE_D5, DOTTED_EIGHTH},
-	{NOTE_CS5, SIXTEENTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, QUARTER},
-	{NOTE_E5, EIGHTH},
-	{NOTE_CS5, DOTTED_EIGHTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_A4, QUARTER},
-	{NOTE_A4, EIGHTH},
-	
-	{NOTE_E5, QUARTER},
-	{NOTE_D5, HALF},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_FS5, DOTTED_EIGHTH},
-	{NOTE_FS5, DOTTED_EIGHTH},
-	{NOTE_E5, DOTTED_QUARTER},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_A5, QUARTER},
-	{NOTE_CS5, EIGHTH},
-	{NOTE_D5, DOTTED_EIGHTH},
-	{NOTE_CS5, SIXTEENTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, QUARTER},
-	{NOTE_E5, EIGHTH},
-	{NOTE_CS5, DOTTED_EIGHTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_A4, QUARTER},
-	{NOTE_A4, EIGHTH},
-	{NOTE_E5, QUARTER},
-	{NOTE_D5, HALF},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
+const uint8_t door_close_harmony[] PROGMEM = {
+	MELODY_BASE,
+	N(G5, EIGHTH),
+	N(E5, EIGHTH),
+	N(C5, EIGHTH),
+	N(G4, QUARTER),
+	END
+};
+#undef MELODY_BASE
+
+#define MELODY_BASE PITCH_CS4
+const uint8_t nokia_melody[] PROGMEM = {
+	MELODY_BASE,
+	N(E5, EIGHTH),
+	N(D5, EIGHTH),
+	N(FS4, QUARTER),
+	N(GS4, QUARTER),
+	N(CS5, EIGHTH),
+	N(B4, EIGHTH),
+	N(D4, QUARTER),
+	N(E4, QUARTER),
+	N(B4, EIGHTH),
+	N(A4, EIGHTH),
+	N(CS4, QUARTER),
+	N(E4, QUARTER),
+	N(A4, HALF),
+	END
+};
+#undef MELODY_BASE
+
+#define MELODY_BASE PITCH_A4
+const uint8_t never_gon_melody[] PROGMEM = {
+	MELODY_BASE,
+	MARK,
+	N(D5, DOTTED_QUARTER),
+	N(E5, DOTTED_QUARTER),
+	N(A4, QUARTER),
+	N(E5, DOTTED_QUARTER),
+	N(FS5, DOTTED_QUARTER),
+	N(A5, SIXTEENTH),
+	N(G5, SIXTEENTH),
+	N(FS5, EIGHTH),
+	N(D5, DOTTED_QUARTER),
+	N(E5, DOTTED_QUARTER),
+	N(A4, HALF),
+	N(A4, SIXTEENTH),
+	N(A4, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(D5, EIGHTH),
+	N(D5, SIXTEENTH),
+	REPEAT(2),
+	R(QUARTER),
+	N(B4, EIGHTH),
+	N(CS5, EIGHTH),
+	N(D5, EIGHTH),
+	N(D5, EIGHTH),
+	N(E5, EIGHTH),
+	N(CS5, DOTTED_EIGHTH),
+	N(B4, SIXTEENTH),
+	N(A4, HALF),
+	R(QUARTER),
+	R(EIGHTH),
+	N(B4, EIGHTH),
+	N(B4, EIGHTH),
+	N(CS5, EIGHTH),
+	N(D5, EIGHTH),
+	N(B4, QUARTER),
+	N(A4, EIGHTH),
+	N(A5, EIGHTH),
+	R(EIGHTH),
+	N(A5, EIGHTH),
+	N(E5, DOTTED_QUARTER),
+	R(QUARTER),
+	N(B4, EIGHTH),
+	N(B4, EIGHTH),
+	N(CS5, EIGHTH),
+	N(D5, EIGHTH),
+	N(B4, EIGHTH),
+	N(D5, EIGHTH),
+	N(E5, EIGHTH),
+	R(EIGHTH),
+	R(EIGHTH),
+	N(CS5, EIGHTH),
+	N(B4, EIGHTH),
+	N(A4, DOTTED_QUARTER),
+	R(QUARTER),
+	R(EIGHTH),
+	N(B4, EIGHTH),
+	N(B4, EIGHTH),
+	N(CS5, EIGHTH),
+	N(D5, EIGHTH),
+	N(B4, EIGHTH),
+	N(A4, QUARTER),
+	R(EIGHTH),
+	N(A5, EIGHTH),
+	N(A5, EIGHTH),
+	N(E5, EIGHTH),
+	N(FS5, EIGHTH),
+	N(E5, EIGHTH),
+	N(D5, EIGHTH),
+	R(EIGHTH),
+	N(A4, EIGHTH),
+	N(B4, EIGHTH),
+	N(CS5, EIGHTH),
+	N(D5, EIGHTH),
+	N(B4, EIGHTH),
+	R(EIGHTH),
+	N(CS5, EIGHTH),
+	N(B4, EIGHTH),
+	N(A4, DOTTED_QUARTER),
+	R(QUARTER),
+	N(B4, EIGHTH),
+	N(B4, EIGHTH),
+	N(CS5, EIGHTH),
+	N(D5, EIGHTH),
+	N(B4, EIGHTH),
+	N(A4, QUARTER),
+	R(EIGHTH),
+	R(EIGHTH),
+	N(E5, EIGHTH),
+	N(E5, EIGHTH),
+	N(FS5, QUARTER),
+	N(E5, DOTTED_QUARTER),
+	N(D5, HALF),
+	N(D5, EIGHTH),
+	N(E5, EIGHTH),
+	N(FS5, EIGHTH),
+	N(E5, QUARTER),
+	N(E5, EIGHTH),
+	N(E5, EIGHTH),
+	N(FS5, EIGHTH),
+	N(E5, EIGHTH),
+	N(A4, EIGHTH),
+	N(A4, QUARTER),
+	R(DOTTED_QUARTER),
+	N(A4, EIGHTH),
+	N(B4, EIGHTH),
+	N(CS5, EIGHTH),
+	N(D5, EIGHTH),
+	N(B4, EIGHTH),
+	R(EIGHTH),
+	N(E5, EIGHTH),
+	N(FS5, EIGHTH),
+	N(E5, DOTTED_QUARTER),
+	N(A4, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(D5, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(FS5, DOTTED_EIGHTH),
+	N(FS5, DOTTED_EIGHTH),
+	N(E5, DOTTED_QUARTER),
+	N(A4, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(D5, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(E5, DOTTED_EIGHTH),
+	N(E5, DOTTED_EIGHTH),
+	MARK,
+	N(D5, DOTTED_EIGHTH),
+	N(CS5, SIXTEENTH),
+	N(B4, EIGHTH),
+	N(A4, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(D5, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(D5, QUARTER),
+	N(E5, EIGHTH),
+	N(CS5, DOTTED_EIGHTH),
+	N(B4, SIXTEENTH),
+	N(A4, QUARTER),
+	N(A4, EIGHTH),
+	N(E5, QUARTER),
+	N(D5, HALF),
+	N(A4, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(D5, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(FS5, DOTTED_EIGHTH),
+	N(FS5, DOTTED_EIGHTH),
+	N(E5, DOTTED_QUARTER),
+	N(A4, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(D5, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(A5, QUARTER),
+	N(CS5, EIGHTH),
+	REPEAT(3),
+	N(D5, DOTTED_EIGHTH),
+	N(CS5, SIXTEENTH),
+	N(B4, EIGHTH),
+	N(A4, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(D5, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(D5, QUARTER),
+	N(E5, EIGHTH),
+	N(CS5, DOTTED_EIGHTH),
+	N(B4, SIXTEENTH),
+	N(A4, QUARTER),
+	N(A4, EIGHTH),
+	N(E5, QUARTER),
+	N(D5, HALF),
+	R(QUARTER),
+	END
+};
+#undef MELODY_BASE
+
+#define MELODY_BASE PITCH_F4
+const uint8_t imperial_march_melody[] PROGMEM = {
+	MELODY_BASE,
+	MARK,
+	N(A4, DOTTED_QUARTER),
+	N(A4, DOTTED_QUARTER),
+	N(A4, SIXTEENTH),
+	N(A4, SIXTEENTH),
+	N(A4, SIXTEENTH),
+	N(A4, SIXTEENTH),
+	N(F4, EIGHTH),
+	R(EIGHTH),
+	REPEAT(2),
+	N(A4, QUARTER),
+	N(A4, QUARTER),
+	N(A4, QUARTER),
+	N(F4, DOTTED_EIGHTH),
+	N(C5, SIXTEENTH),
+	N(A4, QUARTER),
+	N(F4, DOTTED_EIGHTH),
+	N(C5, SIXTEENTH),
+	N(A4, HALF),
+	N(E5, QUARTER),
+	N(E5, QUARTER),
+	N(E5, QUARTER),
+	N(F5, DOTTED_EIGHTH),
+	N(C5, SIXTEENTH),
+	N(A4, QUARTER),
+	N(F4, DOTTED_EIGHTH),
+	N(C5, SIXTEENTH),
+	N(A4, HALF),
+	N(A5, QUARTER),
+	N(A4, DOTTED_EIGHTH),
+	N(A4, SIXTEENTH),
+	N(A5, QUARTER),
+	N(GS5, DOTTED_EIGHTH),
+	N(G5, SIXTEENTH),
+	N(DS5, SIXTEENTH),
+	N(D5, SIXTEENTH),
+	N(DS5, EIGHTH),
+	R(EIGHTH),
+	N(A4, EIGHTH),
+	N(DS5, QUARTER),
+	N(D5, DOTTED_EIGHTH),
+	N(CS5, SIXTEENTH),
+	N(C5, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(C5, SIXTEENTH),
+	R(EIGHTH),
+	N(F4, EIGHTH),
+	N(GS4, QUARTER),
+	N(F4, DOTTED_EIGHTH),
+	N(A4, DOTTED_SIXTEENTH),
+	N(C5, QUARTER),
+	N(A4, DOTTED_EIGHTH),
+	N(C5, SIXTEENTH),
+	N(E5, HALF),
+	N(A5, QUARTER),
+	N(A4, DOTTED_EIGHTH),
+	N(A4, SIXTEENTH),
+	N(A5, QUARTER),
+	N(GS5, DOTTED_EIGHTH),
+	N(G5, SIXTEENTH),
+	N(DS5, SIXTEENTH),
+	N(D5, SIXTEENTH),
+	N(DS5, EIGHTH),
+	R(EIGHTH),
+	N(A4, EIGHTH),
+	N(DS5, QUARTER),
+	N(D5, DOTTED_EIGHTH),
+	N(CS5, SIXTEENTH),
+	N(C5, SIXTEENTH),
+	N(B4, SIXTEENTH),
+	N(C5, SIXTEENTH),
+	R(EIGHTH),
+	N(F4, EIGHTH),
+	N(GS4, QUARTER),
+	N(F4, DOTTED_EIGHTH),
+	N(A4, DOTTED_SIXTEENTH),
+	N(A4, QUARTER),
+	N(F4, DOTTED_EIGHTH),
+	N(C5, SIXTEENTH),
+	N(A4, HALF),
+	END
+};
+#undef MELODY_BASE
+
+#define MELODY_BASE PITCH_E2
+const uint8_t doom_riff_e[] PROGMEM = {
+	MELODY_BASE,
+	N(E2, EIGHTH), N(E2, EIGHTH), N(E3, EIGHTH), N(E2, EIGHTH), N(E2, EIGHTH), N(D3, EIGHTH), N(E2, EIGHTH), N(E2, EIGHTH),
+	N(C3, EIGHTH), N(E2, EIGHTH), N(E2, EIGHTH), N(AS2, EIGHTH), N(E2, EIGHTH), N(E2, EIGHTH), N(B2, EIGHTH), N(C3, EIGHTH),
+	N(E2, EIGHTH), N(E2, EIGHTH), N(E3, EIGHTH), N(E2, EIGHTH), N(E2, EIGHTH), N(D3, EIGHTH), N(E2, EIGHTH), N(E2, EIGHTH),
+	END
+};
+#undef MELODY_BASE
+
+#define MELODY_BASE PITCH_A2
+const uint8_t doom_riff_a[] PROGMEM = {
+	MELODY_BASE,
+	N(A2, EIGHTH), N(A2, EIGHTH), N(A3, EIGHTH), N(A2, EIGHTH), N(A2, EIGHTH), N(G3, EIGHTH), N(A2, EIGHTH), N(A2, EIGHTH),
+	N(F3, EIGHTH), N(A2, EIGHTH), N(A2, EIGHTH), N(DS3, EIGHTH), N(A2, EIGHTH), N(A2, EIGHTH), N(E3, EIGHTH), N(F3, EIGHTH),
+	N(A2, EIGHTH), N(A2, EIGHTH), N(A3, EIGHTH), N(A2, EIGHTH), N(A2, EIGHTH), N(G3, EIGHTH), N(A2, EIGHTH), N(A2, EIGHTH),
+	END
+};
+#undef MELODY_BASE
+
+#define MELODY_BASE PITCH_E3
+const uint8_t doom_arpeggio_e[] PROGMEM = {
+	MELODY_BASE,
+	N(B3, DOTTED_SIXTEENTH), N(G3, DOTTED_SIXTEENTH), N(E3, DOTTED_SIXTEENTH), N(G3, DOTTED_SIXTEENTH), N(B3, DOTTED_SIXTEENTH), N(E4, DOTTED_SIXTEENTH), N(G3, DOTTED_SIXTEENTH), N(B3, DOTTED_SIXTEENTH), N(E4, DOTTED_SIXTEENTH), N(B3, DOTTED_SIXTEENTH), N(G4, DOTTED_SIXTEENTH), N(B4, DOTTED_SIXTEENTH),
+	END
+};
+#undef MELODY_BASE
+
+#define MELODY_BASE PITCH_E2
+const uint8_t doom_melody[] PROGMEM = {
+	MELODY_BASE,
+	MARK,
+	CALL(SEGMENT_DOOM_RIFF_E),
+	N(C3, EIGHTH), N(E2, EIGHTH), N(E2, EIGHTH), N(AS2, DOTTED_HALF),
+	REPEAT(3),
+	CALL(SEGMENT_DOOM_RIFF_E),
+	N(FS3, DOTTED_SIXTEENTH), N(D3, DOTTED_SIXTEENTH), N(B2, DOTTED_SIXTEENTH), N(A3, DOTTED_SIXTEENTH), N(FS3, DOTTED_SIXTEENTH), N(B2, DOTTED_SIXTEENTH), N(D3, DOTTED_SIXTEENTH), N(FS3, DOTTED_SIXTEENTH), N(A3, DOTTED_SIXTEENTH), N(FS3, DOTTED_SIXTEENTH), N(D3, DOTTED_SIXTEENTH), N(B2, DOTTED_SIXTEENTH),
+	CALL(SEGMENT_DOOM_RIFF_E),
+	N(C3, EIGHTH), N(E2, EIGHTH), N(E2, EIGHTH), N(AS2, DOTTED_HALF),
+	CALL(SEGMENT_DOOM_RIFF_E),
+	CALL(SEGMENT_DOOM_ARPEGGIO_E),
+	CALL(SEGMENT_DOOM_RIFF_A),
+	N(F3, EIGHTH), N(A2, EIGHTH), N(A2, EIGHTH), N(DS3, DOTTED_HALF),
+	CALL(SEGMENT_DOOM_RIFF_A),
+	N(A3, DOTTED_SIXTEENTH), N(F3, DOTTED_SIXTEENTH), N(D3, DOTTED_SIXTEENTH), N(A3, DOTTED_SIXTEENTH), N(F3, DOTTED_SIXTEENTH), N(D3, DOTTED_SIXTEENTH), N(C4, DOTTED_SIXTEENTH), N(A3, DOTTED_SIXTEENTH), N(F3, DOTTED_SIXTEENTH), N(A3, DOTTED_SIXTEENTH), N(F3, DOTTED_SIXTEENTH), N(D3, DOTTED_SIXTEENTH),
+	MARK,
+	CALL(SEGMENT_DOOM_RIFF_E),
+	N(C3, EIGHTH), N(E2, EIGHTH), N(E2, EIGHTH), N(AS2, DOTTED_HALF),
+	REPEAT(2),
+	N(CS3, EIGHTH), N(CS3, EIGHTH), N(CS4, EIGHTH), N(CS3, EIGHTH), N(CS3, EIGHTH), N(B3, EIGHTH), N(CS3, EIGHTH), N(CS3, EIGHTH),
+	N(A3, EIGHTH), N(CS3, EIGHTH), N(CS3, EIGHTH), N(G3, EIGHTH), N(CS3, EIGHTH), N(CS3, EIGHTH), N(GS3, EIGHTH), N(A3, EIGHTH),
+	N(B2, EIGHTH), N(B2, EIGHTH), N(B3, EIGHTH), N(B2, EIGHTH), N(B2, EIGHTH), N(A3, EIGHTH), N(B2, EIGHTH), N(B2, EIGHTH),
+	N(G3, EIGHTH), N(B2, EIGHTH), N(B2, EIGHTH), N(F3, DOTTED_HALF),
+	CALL(SEGMENT_DOOM_RIFF_E),
+	CALL(SEGMENT_DOOM_ARPEGGIO_E),
+	CALL(SEGMENT_DOOM_RIFF_E),
+	N(C3, EIGHTH), N(E2, EIGHTH), N(E2, EIGHTH), N(AS2, DOTTED_HALF),
+	CALL(SEGMENT_DOOM_RIFF_E),
+	N(FS3, DOTTED_SIXTEENTH), N(DS3, DOTTED_SIXTEENTH), N(B2, DOTTED_SIXTEENTH), N(FS3, DOTTED_SIXTEENTH), N(DS3, DOTTED_SIXTEENTH), N(B2, DOTTED_SIXTEENTH), N(G3, DOTTED_SIXTEENTH), N(D3, DOTTED_SIXTEENTH), N(B2, DOTTED_SIXTEENTH), N(DS4, DOTTED_SIXTEENTH), N(DS3, DOTTED_SIXTEENTH), N(B2, DOTTED_SIXTEENTH),
+	CALL(SEGMENT_DOOM_RIFF_E),
+	N(C3, EIGHTH), N(E2, EIGHTH), N(E2, EIGHTH), N(AS2, DOTTED_HALF),
+	CALL(SEGMENT_DOOM_RIFF_E),
+	N(E4, DOTTED_SIXTEENTH), N(B3, DOTTED_SIXTEENTH), N(G3, DOTTED_SIXTEENTH), N(G4, DOTTED_SIXTEENTH), N(E4, DOTTED_SIXTEENTH), N(G3, DOTTED_SIXTEENTH), N(B3, DOTTED_SIXTEENTH), N(D4, DOTTED_SIXTEENTH), N(E4, DOTTED_SIXTEENTH), N(G4, DOTTED_SIXTEENTH), N(E4, DOTTED_SIXTEENTH), N(G3, DOTTED_SIXTEENTH),
+	CALL(SEGMENT_DOOM_RIFF_E),
+	N(C3, EIGHTH), N(E2, EIGHTH), N(E2, EIGHTH), N(AS2, DOTTED_HALF),
+	CALL(SEGMENT_DOOM_RIFF_A),
+	N(A3, DOTTED_SIXTEENTH), N(F3, DOTTED_SIXTEENTH), N(D3, DOTTED_SIXTEENTH), N(A3, DOTTED_SIXTEENTH), N(F3, DOTTED_SIXTEENTH), N(D3, DOTTED_SIXTEENTH), N(C4, DOTTED_SIXTEENTH), N(A3, DOTTED_SIXTEENTH), N(F3, DOTTED_SIXTEENTH), N(A3, DOTTED_SIXTEENTH), N(F3, DOTTED_SIXTEENTH), N(D3, DOTTED_SIXTEENTH),
+	MARK,
+	CALL(SEGMENT_DOOM_RIFF_E),
+	N(C3, EIGHTH), N(E2, EIGHTH), N(E2, EIGHTH), N(AS2, DOTTED_HALF),
+	REPEAT(3),
+	CALL(SEGMENT_DOOM_RIFF_E),
+	N(B3, DOTTED_SIXTEENTH), N(G3, DOTTED_SIXTEENTH), N(E3, DOTTED_SIXTEENTH), N(B2, DOTTED_SIXTEENTH), N(E3, DOTTED_SIXTEENTH), N(G3, DOTTED_SIXTEENTH), N(C4, DOTTED_SIXTEENTH), N(B3, DOTTED_SIXTEENTH), N(G3, DOTTED_SIXTEENTH), N(B3, DOTTED_SIXTEENTH), N(G3, DOTTED_SIXTEENTH), N(E3, DOTTED_SIXTEENTH),
+	END
+};
+#undef MELODY_BASE
+
+typedef struct {
+	const uint8_t* data;
+	uint16_t length;
+} MelodySegment;
+
+#define SEGMENT(melody) { melody, sizeof(melody) }
+
+static const MelodySegment melody_segments[SEGMENT_COUNT] PROGMEM = {
+	[SEGMENT_DOOM_RIFF_E] = SEGMENT(doom_riff_e),
+	[SEGMENT_DOOM_RIFF_A] = SEGMENT(doom_riff_a),
+	[SEGMENT_DOOM_ARPEGGIO_E] = SEGMENT(doom_arpeggio_e)
+};
+
+// The sound bank, indexed by sound ID. A new sound is a melody table and
+// a row here.
+#define SOUND(melody, tempo, flags, priority) \
+	{ melody, sizeof(melody), NULL, 0, SOUND_TEMPO(tempo), flags, priority }
+#define SOUND_HARMONY(melody, harmony, tempo, flags, priority) \
+	{ melody, sizeof(melody), harmony, sizeof(harmony), SOUND_TEMPO(tempo), flags, priority }
+
+static const SoundDescriptor sound_bank[] PROGMEM = {
+	[MELODY_EMERGENCY]      = SOUND(emergency_melody, 180, SOUND_REPEAT, SOUND_PRIORITY_EMERGENCY),
+	[MELODY_DOOR_OPEN]      = SOUND_HARMONY(door_open_melody, door_open_harmony, 140, 0, SOUND_PRIORITY_CHIME),
+	[MELODY_DOOR_CLOSE]     = SOUND_HARMONY(door_close_melody, door_close_harmony, 140, 0, SOUND_PRIORITY_CHIME),
+	[MELODY_HARRY_POTTER]   = SOUND(harry_potter_melody, 144, 0, SOUND_PRIORITY_BACKGROUND),
+	[MELODY_NOKIA]          = SOUND(nokia_melody, 180, SOUND_REPEAT, SOUND_PRIORITY_BACKGROUND),
+	[MELODY_NEVER_GON]      = SOUND(never_gon_melody, 114, SOUND_REPEAT, SOUND_PRIORITY_BACKGROUND),
+	[MELODY_IMPERIAL_MARCH] = SOUND(imperial_march_melody, 120, SOUND_REPEAT, SOUND_PRIORITY_BACKGROUND),
+	[MELODY_DOOM]           = SOUND(doom_melody, 225, SOUND_REPEAT, SOUND_PRIORITY_BACKGROUND)
+};
+
+#define SOUND_COUNT (sizeof(sound_bank) / sizeof(sound_bank[0]))
+
+// Work out the note lengths in ticks from the whole note length, once per
+// sound. May run in the sequencer interrupt: shifts and multiplications
+// only, and nothing at all if the tempo has not changed.
+static void setTempo(uint16_t whole_ticks) {
+	if (whole_ticks == note_whole_ticks) {
+		return;
+	}
+	note_whole_ticks = whole_ticks;
 	
-	{NOTE_FS5, DOTTED_EIGHTH},
-	{NOTE_FS5, DOTTED_EIGHTH},
-	{NOTE_E5, DOTTED_QUARTER},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_A5, QUARTER},
-	{NOTE_CS5, EIGHTH},
-	{NOTE_D5, DOTTED_EIGHTH},
-	{NOTE_CS5, SIXTEENTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, QUARTER},
-	{NOTE_E5, EIGHTH},
-	{NOTE_CS5, DOTTED_EIGHTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_A4, QUARTER},
-	{NOTE_A4, EIGHTH},
-	{NOTE_E5, QUARTER},
-	{NOTE_D5, HALF},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_FS5, DOTTED_EIGHTH},
-	{NOTE_FS5, DOTTED_EIGHTH},
-	{NOTE_E5, DOTTED_QUARTER},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
+	for (uint8_t code = 0; code < MELODY_DURATIONS; code++) {
+		// Codes go sixteenth, dotted sixteenth, eighth, ... dotted whole
+		uint32_t ticks = whole_ticks >> (4 - (code >> 1));
+		if (code & 1) {
+			ticks += ticks >> 1; // Dotted note (1.5x duration)
+		}
+		if (ticks == 0) {
+			ticks = 1;
+		} else if (ticks > UINT16_MAX) {
+			ticks = UINT16_MAX;
+		}
+		note_lengths[code].ticks = ticks;
+		note_lengths[code].gate = (ticks * 461 + 511) >> 9; // 90%, rounded up
+	}
+}
+
+// Melody byte at pos, from flash or from an uploaded melody in RAM
+static uint8_t readByte(const MelodyFrame* frame, const uint8_t* pos) {
+	return frame->ram ? *pos : pgm_read_byte(pos);
+}
+
+static void startFrame(MelodyFrame* frame, const uint8_t* data, uint16_t length, bool ram) {
+	frame->ram = ram;
+	frame->base = readByte(frame, data);
+	frame->end = data + length;
+	frame->pos = data + 1;
+	frame->mark = frame->pos;
+	frame->repeating = false;
+}
+
+// Decode up to the next note of a voice into its note
+// Returns false at the end of the track or on malformed data
+static bool nextNote(Voice* voice) {
+	MelodyFrame* frame = &voice->frames[voice->depth];
+	uint8_t extend = 0;
 	
-	{NOTE_A5, QUARTER},
-	{NOTE_CS5, EIGHTH},
-	{NOTE_D5, DOTTED_EIGHTH},
-	{NOTE_CS5, SIXTEENTH},
-	{NOTE_B4, EIGHTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_D5, QUARTER},
-	{NOTE_E5, EIGHTH},
-	{NOTE_CS5, DOTTED_EIGHTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_A4, QUARTER},
-	{NOTE_A4, EIGHTH},
+	for (uint8_t ops = 0; ops < MELODY_MAX_OPS; ops++) {
+		uint8_t code = MELODY_BYTE(MELODY_OPCODE, MELODY_END);
+		if (frame->pos < frame->end) {
+			code = readByte(frame, frame->pos++);
+		}
+		uint8_t pitch = code >> 3;
+		uint8_t arg = code & 0x07;
+		
+		if (pitch != MELODY_OPCODE) {
+			uint8_t index = frame->base + pitch - 1;
+			voice->note.ocr = (pitch != 0 && index < PITCH_COUNT) ? pgm_read_word(&pitch_ocr[index]) : 0;
+			voice->note.ticks = note_lengths[arg + extend].ticks;
+			voice->note.gate = note_lengths[arg + extend].gate;
+			return true;
+		}
+		
+		switch (arg) {
+			case MELODY_END:
+				if (voice->depth > 0) {
+					frame = &voice->frames[--voice->depth]; // back from a segment
+				} else if (repeat_melody) {
+					startFrame(frame, voice->track, voice->length, voice->ram);
+				} else {
+					return false;
+				}
+				break;
+			case MELODY_LONG:
+				extend = 2; // two codes up is twice as long
+				break;
+			case MELODY_MARK:
+				frame->mark = frame->pos;
+				frame->repeating = false;
+				break;
+			case MELODY_REPEAT: {
+				if (frame->pos >= frame->end) {
+					return false;
+				}
+				uint8_t count = readByte(frame, frame->pos++);
+				if (!frame->repeating) {
+					frame->repeating = true;
+					frame->repeats_left = count ? count - 1 : 0;
+				}
+				if (frame->repeats_left > 0) {
+					frame->repeats_left--;
+					frame->pos = frame->mark;
+				} else {
+					frame->repeating = false;
+				}
+				break;
+			}
+			case MELODY_CALL: {
+				if (frame->pos >= frame->end) {
+					return false;
+				}
+				uint8_t segment = readByte(frame, frame->pos++);
+				if (voice->depth > 0 || segment >= SEGMENT_COUNT) {
+					return false;
+				}
+				frame = &voice->frames[++voice->depth];
+				startFrame(frame, pgm_read_ptr(&melody_segments[segment].data),
+					pgm_read_word(&melody_segments[segment].length), false);
+				break;
+			}
+			default:
+				return false;
+		}
+	}
 	
-	{NOTE_E5, QUARTER},
-	{NOTE_D5, HALF},
-	{REST, QUARTER}
-};
+	return false; // too many opcodes in a row
+}
 
-const Note imperial_march_melody[] PROGMEM = {
-	{NOTE_A4, DOTTED_QUARTER},
-	{NOTE_A4, DOTTED_QUARTER},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_F4, EIGHTH},
-	{REST, EIGHTH},
-	{NOTE_A4, DOTTED_QUARTER},
-	{NOTE_A4, DOTTED_QUARTER},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_F4, EIGHTH},
-	{REST, EIGHTH},
-	{NOTE_A4, QUARTER},
-	{NOTE_A4, QUARTER},
-	{NOTE_A4, QUARTER},
-	{NOTE_F4, DOTTED_EIGHTH},
-	{NOTE_C5, SIXTEENTH},
+// Turn the tone of a voice on, or off for 0. Interrupts must be disabled.
+static void setTone(uint8_t voice, uint16_t ocr) {
+	uint8_t com = (voice == 0) ? (1 << COM1A0) : (1 << COM1B0);
 	
-	{NOTE_A4, QUARTER},
-	{NOTE_F4, DOTTED_EIGHTH},
-	{NOTE_C5, SIXTEENTH},
-	{NOTE_A4, HALF},
-	{NOTE_E5, QUARTER},
-	{NOTE_E5, QUARTER},
-	{NOTE_E5, QUARTER},
-	{NOTE_F5, DOTTED_EIGHTH},
-	{NOTE_C5, SIXTEENTH},
-	{NOTE_A4, QUARTER},
-	{NOTE_F4, DOTTED_EIGHTH},
-	{NOTE_C5, SIXTEENTH},
-	{NOTE_A4, HALF},
-	
-	{NOTE_A5, QUARTER},
-	{NOTE_A4, DOTTED_EIGHTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_A5, QUARTER},
-	{NOTE_GS5, DOTTED_EIGHTH},
-	{NOTE_G5, SIXTEENTH},
-	{NOTE_DS5, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_DS5, EIGHTH},
-	{REST, EIGHTH},
-	{NOTE_A4, EIGHTH},
-	{NOTE_DS5, QUARTER},
-	{NOTE_D5, DOTTED_EIGHTH},
-	{NOTE_CS5, SIXTEENTH},
+	if (ocr == 0) {
+		// The pin falls back to its PORT level (low)
+		TCCR1A &= ~com;
+		return;
+	}
 	
-	{NOTE_C5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_C5, SIXTEENTH},
-	{REST, EIGHTH},
-	{NOTE_F4, EIGHTH},
-	{NOTE_GS4, QUARTER},
-	{NOTE_F4, DOTTED_EIGHTH},
-	{NOTE_A4, DOTTED_SIXTEENTH},
-	{NOTE_C5, QUARTER},
-	{NOTE_A4, DOTTED_EIGHTH},
-	{NOTE_C5, SIXTEENTH},
-	{NOTE_E5, HALF},
+	if (!two_voices) {
+		// Buffered, the tone changes at the end of the current period
+		OCR1A = ocr;
+	} else {
+		// The compare interrupt picks the period up at the next toggle. A
+		// voice that was silent starts a new period from now.
+		tone_period[voice] = ocr + 1;
+		if (!(TCCR1A & com)) {
+			if (voice == 0) {
+				OCR1A = TCNT1 + ocr + 1;
+				TIFR1 = (1 << OCF1A);
+			} else {
+				OCR1B = TCNT1 + ocr + 1;
+				TIFR1 = (1 << OCF1B);
+			}
+		}
+	}
+	TCCR1A |= com;
+}
+
+// Sound the decoded note of a voice and count down to its gate
+static void startNote(uint8_t index) {
+	Voice* voice = &voices[index];
+	setTone(index, voice->note.ocr);
+	voice->sounding = true;
+	voice->countdown = voice->note.gate;
+}
+
+// Gate or end of the note of a voice
+// Returns false when the lead track has ended, which ends the melody
+static bool voiceEvent(uint8_t index) {
+	Voice* voice = &voices[index];
 	
-	{NOTE_A5, QUARTER},
-	{NOTE_A4, DOTTED_EIGHTH},
-	{NOTE_A4, SIXTEENTH},
-	{NOTE_A5, QUARTER},
-	{NOTE_GS5, DOTTED_EIGHTH},
-	{NOTE_G5, SIXTEENTH},
-	{NOTE_DS5, SIXTEENTH},
-	{NOTE_D5, SIXTEENTH},
-	{NOTE_DS5, EIGHTH},
-	{REST, EIGHTH},
-	{NOTE_A4, EIGHTH},
-	{NOTE_DS5, QUARTER},
-	{NOTE_D5, DOTTED_EIGHTH},
-	{NOTE_CS5, SIXTEENTH},
+	// Silence the rest of the note for articulation, Timer1 keeps running
+	// for the next note
+	if (voice->sounding && voice->note.gate < voice->note.ticks) {
+		setTone(index, 0);
+		voice->sounding = false;
+		voice->countdown = voice->note.ticks - voice->note.gate;
+		return true;
+	}
 	
-	{NOTE_C5, SIXTEENTH},
-	{NOTE_B4, SIXTEENTH},
-	{NOTE_C5, SIXTEENTH},
-	{REST, EIGHTH},
-	{NOTE_F4, EIGHTH},
-	{NOTE_GS4, QUARTER},
-	{NOTE_F4, DOTTED_EIGHTH},
-	{NOTE_A4, DOTTED_SIXTEENTH},
-	{NOTE_A4, QUARTER},
-	{NOTE_F4, DOTTED_EIGHTH},
-	{NOTE_C5, SIXTEENTH},
-	{NOTE_A4, HALF}
-};
+	if (!nextNote(voice)) {
+		setTone(index, 0);
+		voice->active = false;
+		return index != 0; // a harmony track may end early
+	}
+	startNote(index);
+	return true;
+}
 
-const Note doom_melody[] PROGMEM = {
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //1
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, DOTTED_HALF},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //5
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, DOTTED_HALF},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //9
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, DOTTED_HALF},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //13
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_FS3, DOTTED_SIXTEENTH}, {NOTE_D3, DOTTED_SIXTEENTH}, {NOTE_B2, DOTTED_SIXTEENTH}, {NOTE_A3, DOTTED_SIXTEENTH}, {NOTE_FS3, DOTTED_SIXTEENTH}, {NOTE_B2, DOTTED_SIXTEENTH}, {NOTE_D3, DOTTED_SIXTEENTH}, {NOTE_FS3, DOTTED_SIXTEENTH}, {NOTE_A3, DOTTED_SIXTEENTH}, {NOTE_FS3, DOTTED_SIXTEENTH}, {NOTE_D3, DOTTED_SIXTEENTH}, {NOTE_B2, DOTTED_SIXTEENTH},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //17
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, DOTTED_HALF},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //21
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_B3, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH}, {NOTE_E3, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH}, {NOTE_B3, DOTTED_SIXTEENTH}, {NOTE_E4, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH}, {NOTE_B3, DOTTED_SIXTEENTH}, {NOTE_E4, DOTTED_SIXTEENTH}, {NOTE_B3, DOTTED_SIXTEENTH}, {NOTE_G4, DOTTED_SIXTEENTH}, {NOTE_B4, DOTTED_SIXTEENTH},
-
-	{NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_G3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, //25
-	{NOTE_F3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_DS3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_F3, EIGHTH},
-	{NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_G3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH},
-	{NOTE_F3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_DS3, DOTTED_HALF},
-
-	{NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_G3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, //29
-	{NOTE_F3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_DS3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_F3, EIGHTH},
-	{NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_G3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH},
-	{NOTE_A3, DOTTED_SIXTEENTH}, {NOTE_F3, DOTTED_SIXTEENTH}, {NOTE_D3, DOTTED_SIXTEENTH}, {NOTE_A3, DOTTED_SIXTEENTH}, {NOTE_F3, DOTTED_SIXTEENTH}, {NOTE_D3, DOTTED_SIXTEENTH}, {NOTE_C4, DOTTED_SIXTEENTH}, {NOTE_A3, DOTTED_SIXTEENTH}, {NOTE_F3, DOTTED_SIXTEENTH}, {NOTE_A3, DOTTED_SIXTEENTH}, {NOTE_F3, DOTTED_SIXTEENTH}, {NOTE_D3, DOTTED_SIXTEENTH},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //33
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, DOTTED_HALF},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //37
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, DOTTED_HALF},
-
-	{NOTE_CS3, EIGHTH}, {NOTE_CS3, EIGHTH}, {NOTE_CS4, EIGHTH}, {NOTE_CS3, EIGHTH}, {NOTE_CS3, EIGHTH}, {NOTE_B3, EIGHTH}, {NOTE_CS3, EIGHTH}, {NOTE_CS3, EIGHTH}, //41
-	{NOTE_A3, EIGHTH}, {NOTE_CS3, EIGHTH}, {NOTE_CS3, EIGHTH}, {NOTE_G3, EIGHTH}, {NOTE_CS3, EIGHTH}, {NOTE_CS3, EIGHTH}, {NOTE_GS3, EIGHTH}, {NOTE_A3, EIGHTH},
-	{NOTE_B2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_B3, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_A3, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_B2, EIGHTH},
-	{NOTE_G3, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_F3, DOTTED_HALF},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //45
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_B3, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH}, {NOTE_E3, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH}, {NOTE_B3, DOTTED_SIXTEENTH}, {NOTE_E4, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH}, {NOTE_B3, DOTTED_SIXTEENTH}, {NOTE_E4, DOTTED_SIXTEENTH}, {NOTE_B3, DOTTED_SIXTEENTH}, {NOTE_G4, DOTTED_SIXTEENTH}, {NOTE_B4, DOTTED_SIXTEENTH},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //49
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, DOTTED_HALF},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //53
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_FS3, DOTTED_SIXTEENTH}, {NOTE_DS3, DOTTED_SIXTEENTH}, {NOTE_B2, DOTTED_SIXTEENTH}, {NOTE_FS3, DOTTED_SIXTEENTH}, {NOTE_DS3, DOTTED_SIXTEENTH}, {NOTE_B2, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH}, {NOTE_D3, DOTTED_SIXTEENTH}, {NOTE_B2, DOTTED_SIXTEENTH}, {NOTE_DS4, DOTTED_SIXTEENTH}, {NOTE_DS3, DOTTED_SIXTEENTH}, {NOTE_B2, DOTTED_SIXTEENTH},
-
-	// -/-
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //57
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, DOTTED_HALF},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //61
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_E4, DOTTED_SIXTEENTH}, {NOTE_B3, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH}, {NOTE_G4, DOTTED_SIXTEENTH}, {NOTE_E4, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH}, {NOTE_B3, DOTTED_SIXTEENTH}, {NOTE_D4, DOTTED_SIXTEENTH}, {NOTE_E4, DOTTED_SIXTEENTH}, {NOTE_G4, DOTTED_SIXTEENTH}, {NOTE_E4, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //65
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, DOTTED_HALF},
-
-	{NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_G3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, //69
-	{NOTE_F3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_DS3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_F3, EIGHTH},
-	{NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_G3, EIGHTH}, {NOTE_A2, EIGHTH}, {NOTE_A2, EIGHTH},
-	{NOTE_A3, DOTTED_SIXTEENTH}, {NOTE_F3, DOTTED_SIXTEENTH}, {NOTE_D3, DOTTED_SIXTEENTH}, {NOTE_A3, DOTTED_SIXTEENTH}, {NOTE_F3, DOTTED_SIXTEENTH}, {NOTE_D3, DOTTED_SIXTEENTH}, {NOTE_C4, DOTTED_SIXTEENTH}, {NOTE_A3, DOTTED_SIXTEENTH}, {NOTE_F3, DOTTED_SIXTEENTH}, {NOTE_A3, DOTTED_SIXTEENTH}, {NOTE_F3, DOTTED_SIXTEENTH}, {NOTE_D3, DOTTED_SIXTEENTH},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //73
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, DOTTED_HALF},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //77
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, DOTTED_HALF},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //81
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, DOTTED_HALF},
-
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, //73
-	{NOTE_C3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_AS2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_B2, EIGHTH}, {NOTE_C3, EIGHTH},
-	{NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_D3, EIGHTH}, {NOTE_E2, EIGHTH}, {NOTE_E2, EIGHTH},
-	{NOTE_B3, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH}, {NOTE_E3, DOTTED_SIXTEENTH}, {NOTE_B2, DOTTED_SIXTEENTH}, {NOTE_E3, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH}, {NOTE_C4, DOTTED_SIXTEENTH}, {NOTE_B3, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH}, {NOTE_B3, DOTTED_SIXTEENTH}, {NOTE_G3, DOTTED_SIXTEENTH}, {NOTE_E3, DOTTED_SIXTEENTH}
-};
+// Program the sequencer compare for the nearest voice event. Timer2 only
+// counts to 256, a longer wait takes one compare per full period.
+static void schedule(void) {
+	uint16_t ticks = 256;
+	for (uint8_t i = 0; i < MELODY_VOICES; i++) {
+		if (voices[i].active && voices[i].countdown < ticks) {
+			ticks = voices[i].countdown;
+		}
+	}
+	OCR2A = ticks - 1;
+	scheduled_ticks = ticks;
+}
 
-// Initialize Timer1 for tone generation
+// Start the tone and the sequencer on the decoded first notes
 void startTimer() {
-	// disable interrupts
+	// disable interrupts, may be called from an interrupt
+	uint8_t sreg = SREG;
 	cli();
 	
-	/* Configure buzzer pin as output */
-	BUZZER_DDR |= (1 << BUZZER_PIN);
-	
-	/* Completely reset Timer1 */
 	TCCR1A = 0;
 	TCCR1B = 0;
 	TCNT1 = 0;
-	OCR1A = 0;
+	TIMSK1 = 0;
 	
-	// Get the frequency and convert it to a timer value
-	Note current_note;
-	// Read note from program memory
-	memcpy_P(&current_note, &current_melody[current_note_index], sizeof(Note));
-	uint16_t frequency = current_note.note;
+	BUZZER_PORT &= ~((1 << BUZZER_PIN) | (1 << BUZZER2_PIN));
+	BUZZER_DDR |= (1 << BUZZER_PIN);
 	
-	if (frequency != 0) {
-		// Set up Timer1 in CTC mode (Clear Timer on Compare match)
-		TCCR1B |= (1 << WGM12);
-		
-		// Configure OC1A pin to toggle on compare match
-		TCCR1A |= (1 << COM1A0);
-		
-		// Set compare value
-		OCR1A = frequencyToTimerValue(frequency);
-		
-		// Start timer with no prescaler for maximum frequency range
-		TCCR1B |= (1 << CS10);
-		
-		// Make sure buzzer pin is set as output
-		BUZZER_DDR |= (1 << BUZZER_PIN);
+	if (!two_voices) {
+		// Timer1 runs for the whole melody in fast PWM mode with TOP = OCR1A
+		// (mode 15), where OC1A toggles at TOP and OCR1A is double buffered:
+		// a note change is one register write and never cuts a period short.
+		// The first value is written in normal mode, where it is not buffered.
+		OCR1A = voices[0].note.ocr;
+		TCCR1A = (1 << WGM11) | (1 << WGM10);
+		TCCR1B = (1 << WGM13) | (1 << WGM12) | (1 << CS11); // prescaler 8
 	} else {
-		// This is a pause - disable the output pin
-		BUZZER_DDR &= ~(1 << BUZZER_PIN);
+		// Two frequencies need two independent periods: Timer1 runs free in
+		// normal mode, both compare units toggle their pin and the compare
+		// interrupts move each match half a period on
+		BUZZER_DDR |= (1 << BUZZER2_PIN);
+		TIMSK1 = (1 << OCIE1A) | (1 << OCIE1B);
+		TCCR1B = (1 << CS11); // prescaler 8
 	}
 	
-	// Start the timing timer separately
+	for (uint8_t i = 0; i < MELODY_VOICES; i++) {
+		if (voices[i].active) {
+			startNote(i);
+		}
+	}
+	schedule();
 	startNoteTimer();
 	
-	// enable interrupts
-	sei();
+	SREG = sreg;
 }
 
-// Set up Timer2 for note timing - completely independent of the tone frequency
+// Start Timer2 as the note sequencer, with the first compare already in OCR2A
 void startNoteTimer() {
-	/* Set up Timer2 (8-bit) for note timing */
-	TCNT2 = 0;    // Reset counter
-	TCCR2A = 0;   // Normal mode
 	TCCR2B = 0;   // Stop timer
+	TCNT2 = 0;    // Reset counter
 	
-	// Configure for CTC (Clear Timer on Compare) mode
-	TCCR2A |= (1 << WGM21);
-	
-	// Set prescaler to 64 for 1ms precision
-	// 16MHz / 64 = 250kHz timer frequency
-	TCCR2B |= (1 << CS22);  // prescaler = 64
+	// CTC mode: the compare match is the next note event, not a fixed tick
+	TCCR2A = (1 << WGM21);
 	
-	// With 250kHz timer and OCR2A = 249:
-	// 250kHz / 250 = 1000Hz = 1ms interrupt frequency
-	OCR2A = 249;  // 1ms precision (250 timer ticks)
+	// Prescaler 1024: 16MHz / 1024 = 15625Hz, NOTE_TICK_US (64us) per count
+	TCCR2B = (1 << CS22) | (1 << CS21) | (1 << CS20);
 	
 	// Enable Timer2 compare interrupt
 	TIMSK2 |= (1 << OCIE2A);
 }
 
-// Play a specified melody
-void playMelody(uint8_t sound_id) {
-	// we only use 4 bits from the sound_id
-	sound_id = sound_id & 0x0F;
+// Set a voice up on a track and decode its first note
+// Returns false if there is no track or it has no notes
+static bool startVoice(Voice* voice, const uint8_t* track, uint16_t length, bool ram) {
+	voice->active = false;
+	if (track == NULL || length < 2) {
+		return false;
+	}
 	
-	// Reset melody state
-	current_note_index = 0;
-	current_duration_count = 0;
+	voice->track = track;
+	voice->length = length;
+	voice->ram = ram;
+	voice->depth = 0;
+	startFrame(&voice->frames[0], track, length, ram);
+	voice->active = nextNote(voice);
+	return voice->active;
+}
 
-	if (melody_playing) {
-		stopTimer(); // Stop any currently playing melody
+// Look a sound up in the bank
+// Returns false if there is no playable sound with this ID
+static bool loadSound(uint8_t sound_id, SoundDescriptor* sound) {
+	if (sound_id >= SOUND_COUNT) {
+		return UPLOAD_get_sound(sound_id, sound);
 	}
+	memcpy_P(sound, &sound_bank[sound_id], sizeof(*sound));
+	return sound->data != NULL && sound->length >= 2 && sound->whole_ticks != 0;
+}
+
+// Start a sound from the beginning, stopping the one playing
+// Interrupts must be disabled. Returns false if it has no notes.
+static bool startSound(uint8_t sound_id, const SoundDescriptor* sound) {
+	stopTimer();
 	
-	switch (sound_id) {
-		case MELODY_EMERGENCY:
-			current_melody = emergency_melody;
-			melody_length = sizeof(emergency_melody) / sizeof(Note);
-			repeat_melody = true; // Play emergency sound forever
-			current_tempo = 180; // Faster tempo for emergency
-			break;
-		case MELODY_DOOR_OPEN:
-			current_melody = door_open_melody;
-			melody_length = sizeof(door_open_melody) / sizeof(Note);
-			repeat_melody = false; // Play door sound once
-			current_tempo = 140; // Medium tempo for door open
-			break;
-		case MELODY_DOOR_CLOSE:
-			current_melody = door_close_melody;
-			melody_length = sizeof(door_close_melody) / sizeof(Note);
-			repeat_melody = false; // Play door sound once
-			current_tempo = 140; // Medium tempo for door close
-			break;
-		case MELODY_HARRY_POTTER:
-			current_melody = harry_potter_melody;
-			melody_length = sizeof(harry_potter_melody) / sizeof(Note);
-			repeat_melody = false; // Play once
-			current_tempo = 144;
-			break;
-		case MELODY_NOKIA:
-			current_melody = nokia_melody;
-			melody_length = sizeof(nokia_melody) / sizeof(Note);
-			repeat_melody = true;
-			current_tempo = 180;
-			break;
-		case MELODY_NEVER_GON:
-			current_melody = never_gon_melody;
-			melody_length = sizeof(never_gon_melody) / sizeof(Note);
-			repeat_melody = true;
-			current_tempo = 114;
-			break;
-		case MELODY_IMPERIAL_MARCH:
-			current_melody = imperial_march_melody;
-			melody_length = sizeof(imperial_march_melody) / sizeof(Note);
-			repeat_melody = true;
-			current_tempo = 120;
-			break;
-		case MELODY_DOOM:
-			current_melody = doom_melody;
-			melody_length = sizeof(doom_melody) / sizeof(Note);
-			repeat_melody = true;
-			current_tempo = 225;
-			break;
-		default:
-			return; // Invalid sound ID
+	// Reset melody state and decode the initial notes
+	setTempo(sound->whole_ticks);
+	bool ram = (sound->flags & SOUND_RAM) != 0;
+	if (!startVoice(&voices[0], sound->data, sound->length, ram)) {
+		return false;
 	}
+	two_voices = startVoice(&voices[1], sound->harmony, sound->harmony_length, ram);
+	repeat_melody = (sound->flags & SOUND_REPEAT) != 0;
 	
-	// Read the initial note from program memory
-	Note current_note;
-	memcpy_P(&current_note, &current_melody[current_note_index], sizeof(Note));
+	current_sound = sound_id;
+	current_priority = sound->priority;
+	melody_playing = true;
+	startTimer();
+	return true;
+}
+
+// Keep the position of the sound playing, to resume it later
+static void suspendSound(void) {
+	suspended.sound_id = current_sound;
+	suspended.restart = false;
+	suspended.repeat = repeat_melody;
+	suspended.two_voices = two_voices;
+	memcpy(suspended.voices, voices, sizeof(voices));
+	has_suspended = true;
+}
+
+// Continue the suspended sound, from the start of the note it was stopped in
+// Interrupts must be disabled
+static bool resumeSound(void) {
+	SoundDescriptor sound;
+	has_suspended = false;
+	if (!loadSound(suspended.sound_id, &sound)) {
+		return false;
+	}
+	if (suspended.restart) {
+		return startSound(suspended.sound_id, &sound);
+	}
 	
-	// Calculate initial note duration
-	current_note_duration_ms = calculateNoteDuration(
-		current_note.duration, 
-		current_tempo);
+	stopTimer();
+	setTempo(sound.whole_ticks);
+	memcpy(voices, suspended.voices, sizeof(voices));
+	repeat_melody = suspended.repeat;
+	two_voices = suspended.two_voices;
 	
+	current_sound = suspended.sound_id;
+	current_priority = sound.priority;
 	melody_playing = true;
 	startTimer();
+	return true;
+}
+
+// Start what waits behind the current sound: the oldest chime, then the
+// suspended background sound. Interrupts must be disabled.
+static void nextSound(void) {
+	while (queue_count > 0) {
+		uint8_t sound_id = sound_queue[queue_head];
+		queue_head = (queue_head + 1) % SOUND_QUEUE_SIZE;
+		queue_count--;
+		
+		SoundDescriptor sound;
+		if (loadSound(sound_id, &sound) && startSound(sound_id, &sound)) {
+			return;
+		}
+	}
+	
+	if (has_suspended && resumeSound()) {
+		return;
+	}
+	stopTimer();
+}
+
+// Play a sound, or queue it behind a more important one
+void playMelody(uint8_t sound_id) {
+	SoundDescriptor sound;
+	if (!loadSound(sound_id, &sound)) {
+		return; // No sound with this ID
+	}
+	
+	// disable interrupts, the sequencer switches sounds in its interrupt
+	uint8_t sreg = SREG;
+	cli();
+	
+	if (!melody_playing || sound.priority > current_priority) {
+		// A background sound is kept to resume, a preempted chime is dropped
+		if (melody_playing && current_priority == SOUND_PRIORITY_BACKGROUND) {
+			suspendSound();
+		}
+		if (!startSound(sound_id, &sound)) {
+			nextSound();
+		}
+	} else if (sound.priority == SOUND_PRIORITY_CHIME) {
+		// Chimes wait their turn; one that does not fit is dropped
+		if (queue_count < SOUND_QUEUE_SIZE) {
+			sound_queue[(queue_head + queue_count) % SOUND_QUEUE_SIZE] = sound_id;
+			queue_count++;
+		}
+	} else if (sound.priority == current_priority) {
+		startSound(sound_id, &sound); // a newer background or emergency sound
+	} else {
+		// Background behind a chime or an emergency: it plays once they end
+		suspended.sound_id = sound_id;
+		suspended.restart = true;
+		has_suspended = true;
+	}
+	
+	SREG = sreg;
+}
+
+void stopMelody() {
+	uint8_t sreg = SREG;
+	cli();
+	if (melody_playing) {
+		nextSound();
+	}
+	SREG = sreg;
+}
+
+void forgetSound(uint8_t sound_id) {
+	uint8_t sreg = SREG;
+	cli();
+	if (has_suspended && !suspended.restart && suspended.sound_id == sound_id) {
+		has_suspended = false;
+	}
+	if (melody_playing && current_sound == sound_id) {
+		nextSound();
+	}
+	SREG = sreg;
+}
+
+void stopAllSounds() {
+	uint8_t sreg = SREG;
+	cli();
+	queue_count = 0;
+	has_suspended = false;
+	stopTimer();
+	SREG = sreg;
 }
 
 void stopTimer() {
-	// disable interrupts
+	// disable interrupts, may be called from an interrupt
+	uint8_t sreg = SREG;
 	cli();
 
 	// Stop both timers
@@ -783,90 +1055,64 @@ void stopTimer() {
 	TCNT2 = 0;
 	TIMSK2 = 0;
 	
-	// Reset buzzer pin to ensure no sound
-	BUZZER_DDR &= ~(1 << BUZZER_PIN);
+	// Reset buzzer pins to ensure no sound
+	BUZZER_DDR &= ~((1 << BUZZER_PIN) | (1 << BUZZER2_PIN));
 	
 	melody_playing = false;
 	repeat_melody = false;
+	two_voices = false;
+
+	SREG = sreg;
+}
+
+bool isMelodyPlaying() {
+	return melody_playing;
+}
 
-	// enable interrupts
-	sei();
+void getBuzzerStats(BuzzerStats* stats) {
+	uint8_t sreg = SREG;
+	cli();
+	*stats = buzzer_stats;
+	SREG = sreg;
 }
 
-// Timer2 compare match interrupt handler - for note timing
+// Timer2 compare match interrupt handler - the note sequencer
+// Runs only at the gates and ends of the notes, plus once per 256 ticks
+// (16.4 ms) of a longer wait; a note change decodes at most MELODY_MAX_OPS
+// bytes per voice
 ISR(TIMER2_COMPA_vect) {
-	static uint32_t elapsed_ms = 0;
-	
 	if (!melody_playing) {
 		return;
 	}
+	buzzer_stats.sequencer_interrupts++;
 	
-	// Each interrupt is now exactly 1ms
-	elapsed_ms += 1;
-	
-	// Check if we've played the current note for 90% of its duration
-	// This creates the slight gap between notes for better articulation
-	if (elapsed_ms >= current_note_duration_ms * 0.9) {
-		// Silence the note during the remaining 10% of its duration
-		// by stopping the timer, the note generator timer, remember to turn it on again when the next note starts
-		TCCR1B &= ~((1 << CS12) | (1 << CS11) | (1 << CS10));
-	}
-	
-	// Move to the next note after the full duration
-	if (elapsed_ms >= current_note_duration_ms) {
-		elapsed_ms = 0;
-		current_note_index++;
-		
-		// Check if we've reached the end of the melody
-		if (current_note_index >= melody_length) {
-			if (repeat_melody) {
-				// Loop back to the beginning of the melody
-				current_note_index = 0;
-			} else {
-				// Stop if we don't need to repeat
-				stopTimer();
-				return;
-			}
+	for (uint8_t i = 0; i < MELODY_VOICES; i++) {
+		Voice* voice = &voices[i];
+		if (!voice->active) {
+			continue;
+		}
+		voice->countdown -= scheduled_ticks;
+		if (voice->countdown != 0) {
+			continue;
 		}
 		
-		// Read the new note from program memory
-		Note current_note;
-		memcpy_P(&current_note, &current_melody[current_note_index], sizeof(Note));
-		
-		// Calculate duration for the new note
-		current_note_duration_ms = calculateNoteDuration(
-			current_note.duration, 
-			current_tempo);
-		
-		// Check if the next note is a pause or a normal note
-		uint16_t frequency = current_note.note;
-		
-		// Reset Timer1 completely
-		TCCR1A = 0;
-		TCCR1B = 0;
-		TCNT1 = 0;
-		
-		if (frequency != 0) {
-			// Normal note - set up the timer
-			
-			// Configure buzzer pin as output
-			BUZZER_DDR |= (1 << BUZZER_PIN);
-			
-			// Set up Timer1 in CTC mode
-			TCCR1B |= (1 << WGM12);
-			
-			// Configure OC1A pin to toggle on compare match
-			TCCR1A |= (1 << COM1A0);
-			
-			// Set compare value based on frequency
-			OCR1A = frequencyToTimerValue(frequency);
-			
-			// Start the timer with no prescaler
-			TCCR1B |= (1 << CS10);
-		} else {
-			// This is a pause/rest - keep the timer stopped
-			// and make sure the pin is not toggling
-			BUZZER_DDR &= ~(1 << BUZZER_PIN);
+		// At the end of the melody, unless it repeats, go on with the next
+		// sound waiting
+		if (!voiceEvent(i)) {
+			nextSound();
+			return;
 		}
 	}
-}
\ No newline at end of file
+	schedule();
+}
+
+// Two-voice mode: the next toggle of each voice is half a period on
+ISR(TIMER1_COMPA_vect) {
+	OCR1A += tone_period[0];
+	buzzer_stats.tone_interrupts++;
+}
+
+ISR(TIMER1_COMPB_vect) {
+	OCR1B += tone_period[1];
+	buzzer_stats.tone_interrupts++;
+}
@@ -17,21 +17,137 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
-// Define a structure to hold note and duration
+// Timing of the notes
+#define NOTE_TICK_US   64UL    // sequencer (Timer2) count, F_CPU / 1024
+#define TONE_PRESCALER 8UL     // tone timer (Timer1) clock divider
+
+// Timer1 compare value for a tone in Hz; OC1A toggles at every TOP:
+// f = F_CPU / (2 * TONE_PRESCALER * (1 + OCR)). 0 is a rest.
+#define TONE_OCR(freq) ((freq) == 0 ? 0 : (uint16_t)(F_CPU / (2UL * TONE_PRESCALER * (freq)) - 1))
+
+/*
+ * Compressed melody format, one byte per note:
+ *
+ *   7       3 2     0
+ *   +---------+-------+
+ *   |  pitch  |  dur  |
+ *   +---------+-------+
+ *
+ * pitch 0 is a rest, 1-30 is the semitone base + pitch - 1 (see Pitch in
+ * notes.h), 31 marks an opcode with the opcode number in dur. dur indexes
+ * the note lengths: sixteenth, dotted sixteenth, eighth, ... dotted half.
+ * The lengths in sequencer ticks are worked out from the whole note
+ * length of the sound, SOUND_TEMPO(), with shifts only, up to 65535 ticks
+ * (4.19 s), so the player only loads them. The division by the tempo is
+ * left to the compiler, or to the main loop for uploaded sounds, as a
+ * sound may start from the sequencer interrupt.
+ *
+ * Sounds in the bank are in flash; uploaded sounds (upload.h) are played
+ * from RAM and may call the segments of the bank.
+ *
+ * A melody or segment starts with its base pitch and ends with
+ * MELODY_END. The player decodes at most MELODY_MAX_OPS bytes per note.
+ *
+ * A sound may add a harmony track in the same format, played on OC1B with
+ * the lead on OC1A. Each track keeps its own position and repeats at its
+ * own MELODY_END, so both should have the same length; the sound ends with
+ * the lead track.
+ */
+#define MELODY_OPCODE   31
+
+#define MELODY_END      0   // end of a segment, or of the melody (repeats if set)
+#define MELODY_LONG     1   // next note twice as long: half -> whole
+#define MELODY_MARK     2   // start of a part to repeat
+#define MELODY_REPEAT   3   // + count: play the part since MELODY_MARK count times in total
+#define MELODY_CALL     4   // + segment number: play a segment, one level deep
+
+#define MELODY_DURATIONS 10 // codes 0-7, and 8-9 through MELODY_LONG
+#define MELODY_MAX_OPS   8
+#define MELODY_VOICES    2  // lead and harmony
+
+#define MELODY_BYTE(pitch, dur) (((pitch) << 3) | (dur))
+
+// Note length code of a NoteDuration, 0x100 (a compiler warning) if it
+// has none; whole notes are MELODY_LONG with a half note
+#define DURATION_CODE(dur) \
+    ((dur) == SIXTEENTH ? 0 : (dur) == DOTTED_SIXTEENTH ? 1 : \
+     (dur) == EIGHTH ? 2 : (dur) == DOTTED_EIGHTH ? 3 : \
+     (dur) == QUARTER ? 4 : (dur) == DOTTED_QUARTER ? 5 : \
+     (dur) == HALF ? 6 : (dur) == DOTTED_HALF ? 7 : 0x100)
+
+// Sound bank entry, stored in PROGMEM
 typedef struct {
-    uint16_t note;     // Note frequency (0 = pause/silence)
-    int8_t duration;   // Duration enum from NoteDuration
+    const uint8_t* data;    // melody in the format above, PROGMEM (RAM with SOUND_RAM)
+    uint16_t length;        // bytes
+    const uint8_t* harmony; // second track or NULL, same memory as data
+    uint16_t harmony_length;
+    uint16_t whole_ticks;   // whole note in sequencer ticks, SOUND_TEMPO()
+    uint8_t flags;          // SOUND_REPEAT, SOUND_RAM
+    uint8_t priority;       // SOUND_PRIORITY_*
+} SoundDescriptor;
+
+// Whole note length of a tempo in beats per minute, at most 65535 ticks
+#define SOUND_TEMPO(bpm) \
+    ((60000000UL * 4 / NOTE_TICK_US) / (bpm) > UINT16_MAX ? UINT16_MAX : \
+     (uint16_t)((60000000UL * 4 / NOTE_TICK_US) / (bpm)))
+
+#define SOUND_REPEAT 0x01   // play until stopped
+#define SOUND_RAM    0x02   // melody in RAM, an uploaded sound (upload.h)
+
+#define SOUND_PRIORITY_BACKGROUND 0  // entertainment
+#define SOUND_PRIORITY_CHIME      1  // door and arrival sounds
+#define SOUND_PRIORITY_EMERGENCY  2
+
+/*
+ * Sound scheduling by priority. A more important sound preempts the one
+ * playing: a background sound is suspended with its position and resumes
+ * once nothing more important is left, a preempted chime is dropped. Chimes
+ * queue behind a chime or an emergency sound, up to SOUND_QUEUE_SIZE. A
+ * background sound requested meanwhile replaces the suspended one. A sound
+ * of the same priority replaces the one playing.
+ *
+ * The next sound starts from the sequencer interrupt when one ends, or from
+ * stopMelody().
+ */
+#define SOUND_QUEUE_SIZE 4
+
+// Define a structure to hold the note being played
+typedef struct {
+    uint16_t ocr;      // Timer1 compare value (0 = pause/silence)
+    uint16_t ticks;    // note length in sequencer ticks, 1 or more
+    uint16_t gate;     // ticks until the tone is silenced, 1 - ticks
 } Note;
 
-// Function declarations
-uint16_t frequencyToTimerValue(uint16_t frequency);
-uint32_t calculateNoteDuration(int8_t duration, uint16_t tempo);
+/*
+ * Interrupt counts, for measuring the buzzer load.
+ *
+ * The sequencer interrupts at most once per note event (gate or note end)
+ * of each voice, plus once per 16.4 ms of a longer wait.
+ *
+ * A lead-only sound makes its tone in hardware. A sound with harmony runs
+ * Timer1 free with one compare interrupt per half period of each voice:
+ * 2 * f per second, at most ~10000 per voice at the top note (DS8), about
+ * 40 cycles each, so under 5% of the CPU for both voices. The half period
+ * there (100 us) also bounds how long other interrupts may block.
+ */
+typedef struct {
+    uint32_t sequencer_interrupts;
+    uint32_t tone_interrupts;
+} BuzzerStats;
 
+// Function declarations
 void startTimer(void);
 void startNoteTimer(void);
 void playMelody(uint8_t sound_id);
+void stopMelody(void);      // stop the current sound, the next one waiting plays
+void stopAllSounds(void);   // stop, and forget queued and suspended sounds
+void forgetSound(uint8_t sound_id); // its data changes: stop it if playing or suspended
 void stopTimer(void);
+bool isMelodyPlaying(void);
+void getBuzzerStats(BuzzerStats* stats);
 
+// Sound IDs, the index into the sound bank in Buzzer.c. IDs above 15 are
+// sent with SPEAKER_EXT_ID. Uploaded sounds follow from UPLOAD_FIRST_SOUND.
 #define MELODY_EMERGENCY 0  // Emergency sound pattern
 #define MELODY_DOOR_OPEN 1  // Door opening sound
 #define MELODY_DOOR_CLOSE 2 // Door closing sound
@@ -3,12 +3,59 @@
  *
  * Created: 25.4.2025
  *  Author: mrMikoma
- */ 
+ */
  #define F_CPU 16000000UL
  #include "led.h"
- #include <util/delay.h>
- 
- #define BLINK_DELAY_MS 300  // Fixed delay for blinking
+ #include <avr/interrupt.h>
+ #include <avr/pgmspace.h>
+ #include <stddef.h>
+
+ // Common
+ #include "systick.h"
+
+ #define BLINK_STEP_MS 300      // Fixed on/off time for blinking
+ #define HEARTBEAT_STEP_MS 100  // Two short flashes, then a pause
+
+// Perceived brightness to PWM duty, gamma 2.2. Every level above 0 gives
+// at least the shortest pulse, so the first fade steps are visible.
+static const uint8_t gamma_table[256] PROGMEM = {
+      0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+      1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+      3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+      6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+     12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+     20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+     30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+     42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+     56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+     73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+     91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+    113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+    137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+    163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+    192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+    223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255,
+};
+
+typedef struct {
+    volatile uint8_t *port;     // NULL until led_channel_init()
+    uint8_t mask;
+    volatile uint8_t *ocr;      // NULL: on/off only
+    uint8_t com;                // COM0x1 bit in TCCR0A
+    uint8_t on_level;           // brightness of "on" and of pattern steps
+    uint8_t level;              // brightness outside of a pattern or fade
+    uint8_t out;                // brightness currently shown
+    led_pattern_t pattern;      // length 0: no pattern running
+    uint8_t step;
+    uint8_t remaining;          // repeats left
+    uint32_t next_ms;           // time of the next step
+    uint16_t fade_pos;          // brightness, 8.8 fixed point
+    int16_t fade_step;          // added on every tick
+    uint16_t fade_ticks;        // ticks left, 0: no fade running
+} led_channel_t;
+
+static led_channel_t channels[LED_CHANNELS];
+static bool tick_registered = false;
 
 void led_init(volatile uint8_t *ddr, volatile uint8_t *port, uint8_t pin) {
     *ddr |= (1 << pin);
@@ -27,11 +74,182 @@ void led_toggle(volatile uint8_t *port, uint8_t pin) {
     *port ^= (1 << pin);
 }
 
-void led_blink(volatile uint8_t *port, uint8_t pin, uint8_t times) {
-    for (uint8_t i = 0; i < times; i++) {
-        led_on(port, pin);
-        _delay_ms(BLINK_DELAY_MS);
-        led_off(port, pin);
-        _delay_ms(BLINK_DELAY_MS);
+// Shows a brightness. Full on and off are plain GPIO levels with the
+// compare output disconnected; only levels in between need Timer0 running.
+static void led_output(led_channel_t *c, uint8_t level) {
+    c->out = level;
+
+    if (c->ocr != NULL) {
+        uint8_t duty = pgm_read_byte(&gamma_table[level]);
+        if (duty != 0 && duty != 255) {
+            *c->ocr = duty;     // buffered, takes effect at the next TOP
+            TCCR0A |= c->com;
+            return;
+        }
+        TCCR0A &= ~c->com;
+    }
+
+    if (level != 0) {
+        *c->port |= c->mask;
+    } else {
+        *c->port &= ~c->mask;
+    }
+}
+
+static void led_write(led_channel_t *c, bool on) {
+    led_output(c, on ? c->on_level : 0);
+}
+
+// Runs on every system tick: advances every pattern whose step is due
+static void led_tick(void) {
+    uint32_t now = SYSTICK_millis();
+
+    for (uint8_t i = 0; i < LED_CHANNELS; i++) {
+        led_channel_t *c = &channels[i];
+
+        if (c->fade_ticks != 0) {
+            c->fade_pos += c->fade_step;
+            led_output(c, --c->fade_ticks == 0 ? c->level : c->fade_pos >> 8);
+            continue;
+        }
+
+        if (c->pattern.length == 0 || (int32_t)(now - c->next_ms) < 0) continue;
+
+        c->next_ms += c->pattern.step_ms;
+        if (++c->step == c->pattern.length) {
+            c->step = 0;
+            if (c->pattern.repeats != LED_FOREVER && --c->remaining == 0) {
+                c->pattern.length = 0;
+                led_output(c, c->level);
+                continue;
+            }
+        }
+        led_write(c, (c->pattern.bits >> c->step) & 1);
+    }
+}
+
+void led_channel_init(uint8_t channel, volatile uint8_t *ddr, volatile uint8_t *port, uint8_t pin) {
+    if (channel >= LED_CHANNELS) return;
+
+    led_init(ddr, port, pin);
+
+    led_channel_t *c = &channels[channel];
+    c->port = port;
+    c->mask = (1 << pin);
+    c->ocr = NULL;
+    c->on_level = 255;
+    c->level = 0;
+    c->out = 0;
+    c->pattern.length = 0;
+    c->fade_ticks = 0;
+
+    if (!tick_registered) {
+        tick_registered = SYSTICK_add_callback(led_tick);
+    }
+}
+
+void led_channel_pwm(uint8_t channel, uint8_t output) {
+    if (channel >= LED_CHANNELS || channels[channel].port == NULL) return;
+
+    // Timer0 already runs in fast PWM mode as the system tick, the compare
+    // outputs are connected per level in led_output()
+    led_channel_t *c = &channels[channel];
+    if (output == LED_PWM_OC0A) {
+        c->ocr = &OCR0A;
+        c->com = (1 << COM0A1);
+    } else {
+        c->ocr = &OCR0B;
+        c->com = (1 << COM0B1);
+    }
+}
+
+void led_set(uint8_t channel, bool on) {
+    if (channel >= LED_CHANNELS || channels[channel].port == NULL) return;
+
+    uint8_t sreg = SREG;
+    cli();
+    led_channel_t *c = &channels[channel];
+    c->pattern.length = 0;
+    c->fade_ticks = 0;
+    c->level = on ? c->on_level : 0;
+    led_output(c, c->level);
+    SREG = sreg;
+}
+
+void led_fade(uint8_t channel, uint8_t level, uint16_t ms) {
+    if (channel >= LED_CHANNELS || channels[channel].port == NULL) return;
+
+    // Work out the step before disabling interrupts
+    uint32_t ticks = ((uint32_t)ms * 1000UL) / SYSTICK_US_PER_TICK;
+    if (ticks > UINT16_MAX) ticks = UINT16_MAX;
+
+    uint8_t sreg = SREG;
+    cli();
+    led_channel_t *c = &channels[channel];
+    c->pattern.length = 0;
+    c->level = level;
+    if (level != 0) c->on_level = level;
+
+    if (ticks < 2) {
+        c->fade_ticks = 0;
+        led_output(c, level);
+    } else {
+        c->fade_pos = (uint16_t)c->out << 8;
+        c->fade_step = (int16_t)((((int32_t)level - c->out) << 8) / (int32_t)ticks);
+        c->fade_ticks = (uint16_t)ticks;
+    }
+    SREG = sreg;
+}
+
+void led_start(uint8_t channel, const led_pattern_t *pattern) {
+    if (channel >= LED_CHANNELS || channels[channel].port == NULL) return;
+    if (pattern->length == 0 || pattern->length > 16) return;
+
+    uint8_t sreg = SREG;
+    cli();
+    led_channel_t *c = &channels[channel];
+    c->pattern = *pattern;
+    c->fade_ticks = 0;
+    c->step = 0;
+    c->remaining = pattern->repeats;
+    c->next_ms = SYSTICK_millis() + pattern->step_ms;
+    led_write(c, pattern->bits & 1);
+    SREG = sreg;
+}
+
+void led_stop(uint8_t channel) {
+    if (channel >= LED_CHANNELS || channels[channel].port == NULL) return;
+
+    uint8_t sreg = SREG;
+    cli();
+    led_channel_t *c = &channels[channel];
+    c->pattern.length = 0;
+    c->fade_ticks = 0;
+    led_output(c, c->level);
+    SREG = sreg;
+}
+
+void led_blink(uint8_t channel, uint8_t times) {
+    if (times == 0) return;
+    led_pattern_t blink = { 0x0001, 2, BLINK_STEP_MS, times };
+    led_start(channel, &blink);
+}
+
+void led_pulse(uint8_t channel, uint16_t ms) {
+    led_pattern_t pulse = { 0x0001, 1, ms, 1 };
+    led_start(channel, &pulse);
+}
+
+void led_heartbeat(uint8_t channel) {
+    led_pattern_t heartbeat = { 0x0005, 10, HEARTBEAT_STEP_MS, LED_FOREVER };
+    led_start(channel, &heartbeat);
+}
+
+bool led_busy(void) {
+    for (uint8_t i = 0; i < LED_CHANNELS; i++) {
+        const led_channel_t *c = &channels[i];
+        if (c->pattern.length != 0 || c->fade_ticks != 0) return true;
+        if (c->ocr != NULL && (TCCR0A & c->com)) return true;
     }
+    return false;
 }
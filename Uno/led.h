@@ -3,7 +3,7 @@
  *
  * Created: 25.4.2025
  *  Author: mrMikoma
- */ 
+ */
 
 #ifndef LED_H
 #define LED_H
@@ -11,11 +11,49 @@
 #define F_CPU 16000000UL
 
 #include <avr/io.h>
+#include <stdbool.h>
 
+#define LED_CHANNELS 4  // LEDs that can run a pattern at the same time
+
+#define LED_FOREVER  0  // repeats: run until stopped
+
+// Timer0 compare outputs for led_channel_pwm()
+#define LED_PWM_OC0A 0  // PD6
+#define LED_PWM_OC0B 1  // PD5
+
+/*
+ * A pattern is a sequence of up to 16 on/off steps, bit 0 first, all of the
+ * same length. It runs `repeats` times (LED_FOREVER for no limit), then the
+ * LED returns to the level last set with led_set() or led_fade().
+ *
+ * On a PWM channel, brightness is 0-255 in perceived steps and gamma
+ * corrected. The compare unit generates the waveform; a fade only rewrites
+ * the buffered compare register from the system tick. "On" and the pattern
+ * steps use the last brightness faded to.
+ */
+typedef struct {
+    uint16_t bits;
+    uint8_t length;     // steps, 1-16
+    uint16_t step_ms;
+    uint8_t repeats;
+} led_pattern_t;
+
+// Direct GPIO control
 void led_init(volatile uint8_t *ddr, volatile uint8_t *port, uint8_t pin);
 void led_on(volatile uint8_t *port, uint8_t pin);
 void led_off(volatile uint8_t *port, uint8_t pin);
 void led_toggle(volatile uint8_t *port, uint8_t pin);
-void led_blink(volatile uint8_t *port, uint8_t pin, uint8_t times);
+
+// Pattern engine, driven from the system tick (requires SYSTICK_init())
+void led_channel_init(uint8_t channel, volatile uint8_t *ddr, volatile uint8_t *port, uint8_t pin);
+void led_channel_pwm(uint8_t channel, uint8_t output);
+void led_set(uint8_t channel, bool on);
+void led_fade(uint8_t channel, uint8_t level, uint16_t ms);  // ms 0: set at once
+void led_start(uint8_t channel, const led_pattern_t *pattern);
+void led_stop(uint8_t channel);
+void led_blink(uint8_t channel, uint8_t times);
+void led_pulse(uint8_t channel, uint16_t ms);
+void led_heartbeat(uint8_t channel);
+bool led_busy(void);  // true while the LEDs need the system tick
 
 #endif
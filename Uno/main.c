@@ -18,68 +18,218 @@
 #include "Buzzer.h"
 #include "led.h"
 #include "pins.h"
+#include "upload.h"
 
 // Common
 #include "usart.h"
 #include "message.h"
 #include "twi.h"
+#include "systick.h"
+#include "idle.h"
+
+#define SLEEP_REPORT_MS 30000 // Interval for printing the sleep ratio
+
+// LED pattern channels
+#define MOVEMENT_LED 0
+#define DOOR_LED     1
+
+// Commands are not applied frame by frame: the TWI interrupt folds every
+// frame into a target state, later frames overriding earlier ones, and the
+// main loop applies only the net change. A burst of frames then costs one
+// melody reload at most, and superseded commands never touch the hardware.
+// A sound stop is the exception: it is kept under a later play, as the
+// sound scheduler would otherwise suspend the sound instead of ending it.
+typedef enum {
+    LED_KEEP = 0,
+    LED_TURN_ON,
+    LED_TURN_OFF,
+    LED_FADE
+} LedOp;
+
+typedef enum {
+    SOUND_KEEP = 0,
+    SOUND_PLAY,
+    SOUND_STOP
+} SoundOp;
+
+typedef struct {
+    uint8_t op;         // LedOp
+    uint8_t level;      // LED_FADE
+    uint16_t fade_ms;   // LED_FADE
+    bool blink;         // blink after the op
+} LedTarget;
+
+typedef struct {
+    LedTarget led[2];   // MOVEMENT_LED, DOOR_LED
+    uint8_t sound_op;   // SoundOp
+    uint8_t sound_id;
+    bool sound_stop;    // a stop came before the play, it must not be folded away
+    uint8_t frames;     // valid frames folded in
+    uint8_t invalid;    // frames rejected
+} CommandTarget;
+
+static CommandTarget pending;                // written in the TWI interrupt
+static volatile bool commands_pending = false;
+static LedTarget applied[2];                 // last steady LED state applied
+static volatile uint8_t emergency_count = 0;
+static uint8_t emergencies_reported = 0;     // emergency_count printed so far
+
+// Statistics, printed with the sleep report
+static uint16_t frames_folded = 0;
+static uint16_t commands_applied = 0;
+static uint16_t commands_dropped = 0;
+
+static void fold_led(LedTarget *t, uint8_t op, uint8_t level, uint16_t fade_ms) {
+    t->op = op;
+    t->level = level;
+    t->fade_ms = fade_ms;
+    t->blink = false;   // a new level cancels the blink, as led_set() does
+}
 
 // This function handles incoming messages - it will be called directly from the interrupt
 void handle_message(uint32_t message) {
-    // Debug info
-    printf("Received message: ");
-    USART_print_binary(message, 32);
-    printf("\n");
-    
-    // Check if the message is valid
+    // Emergency stop goes first; it is only counted here, the main loop
+    // prints it, as a printf would stretch the TWI clock for milliseconds
+    if ((message >> 16) & EMERGENCY_STOP) {
+        if (is_valid_message(message)) {
+            // The trip is over: queued and suspended sounds go too
+            stopAllSounds();
+            led_set(MOVEMENT_LED, false);
+            // Pending sound and movement commands are older than the stop
+            pending.sound_op = SOUND_KEEP;
+            pending.sound_stop = false;
+            pending.led[MOVEMENT_LED].op = LED_KEEP;
+            pending.led[MOVEMENT_LED].blink = false;
+            applied[MOVEMENT_LED].op = LED_TURN_OFF;
+            emergency_count++;
+            return;
+        }
+    }
+
     if (!is_valid_message(message)) {
-        printf("Invalid message format\n");
+        pending.invalid++;
+        commands_pending = true;
         return;
     }
-    
-    printf("Valid message detected\n");
-    
-    // Extract control bits from the message
+
     uint16_t control_bits = message >> 16;
-    
-    // Print control bits for debugging
-    printf("Control flags: ");
-    USART_print_binary(control_bits, 16);
-    printf("\n");
-    
-    // Control LEDs
+
+    // Upload frames are staged apart from the commands
+    if (control_bits & SOUND_UPLOAD) {
+        UPLOAD_handle(message);
+        return;
+    }
+
+    // Fold in the order the flags were applied one by one before
     if (control_bits & LED_MOVING_ON) {
-        led_on(&MOVEMENT_LED_PORT, MOVEMENT_LED_PIN);
-        printf("Movement LED ON\n");
+        fold_led(&pending.led[MOVEMENT_LED], LED_TURN_ON, 0, 0);
     }
     if (control_bits & LED_MOVING_OFF) {
-        led_off(&MOVEMENT_LED_PORT, MOVEMENT_LED_PIN);
-        printf("Movement LED OFF\n");
+        fold_led(&pending.led[MOVEMENT_LED], LED_TURN_OFF, 0, 0);
     }
     if (control_bits & LED_MOVING_BLINK) {
-        led_blink(&MOVEMENT_LED_PORT, MOVEMENT_LED_PIN, 3);
-        printf("Movement LED blinking\n");
+        pending.led[MOVEMENT_LED].blink = true;
     }
     if (control_bits & LED_DOOR_OPEN) {
-        led_on(&DOOR_LED_PORT, DOOR_LED_PIN);
-        printf("Door LED ON\n");
+        fold_led(&pending.led[DOOR_LED], LED_TURN_ON, 0, 0);
     }
     if (control_bits & LED_DOOR_CLOSE) {
-        led_off(&DOOR_LED_PORT, DOOR_LED_PIN);
-        printf("Door LED OFF\n");
+        fold_led(&pending.led[DOOR_LED], LED_TURN_OFF, 0, 0);
+    }
+    if (control_bits & LED_DIM) {
+        uint8_t led, level;
+        uint16_t fade_ms;
+        read_message_dim(message, &led, &level, &fade_ms);
+        fold_led(&pending.led[led == DIM_LED_DOOR ? DOOR_LED : MOVEMENT_LED], LED_FADE, level, fade_ms);
     }
-    
-    // Handle speaker
     if (control_bits & SPEAKER_PLAY) {
-        uint8_t sound_id = (message >> 12) & 0x0F;
-        printf("Playing sound ID: ");
-        USART_send_binary(sound_id);
-        printf("\n");
-        playMelody(sound_id);
+        pending.sound_op = SOUND_PLAY;
+        pending.sound_id = read_message_sound(message);
     }
     if (control_bits & SPEAKER_STOP) {
-        printf("Stopping sound\n");
-        stopTimer();
+        pending.sound_op = SOUND_STOP;
+        pending.sound_stop = true;
+    }
+
+    pending.frames++;
+    commands_pending = true;
+}
+
+static bool same_level(const LedTarget *a, const LedTarget *b) {
+    if (a->op != b->op) return false;
+    return a->op != LED_FADE || a->level == b->level;
+}
+
+static void apply_led(uint8_t channel, const LedTarget *t, const char *name) {
+    if (t->op != LED_KEEP) {
+        if (same_level(t, &applied[channel])) {
+            commands_dropped++;
+        } else {
+            if (t->op == LED_TURN_ON) {
+                led_set(channel, true);
+                printf("%s LED ON\n", name);
+            } else if (t->op == LED_TURN_OFF) {
+                led_set(channel, false);
+                printf("%s LED OFF\n", name);
+            } else {
+                led_fade(channel, t->level, t->fade_ms);
+                printf("%s LED to %u in %u ms\n", name, t->level, t->fade_ms);
+            }
+            applied[channel] = *t;
+            commands_applied++;
+        }
+    }
+    if (t->blink) {
+        // Runs from the system tick, returns right away
+        led_blink(channel, 3);
+        printf("%s LED blinking\n", name);
+        commands_applied++;
+    }
+}
+
+// Applies the net change of all frames received since the last call
+static void apply_commands(void) {
+    cli();
+    CommandTarget t = pending;
+    pending = (CommandTarget){ 0 };
+    commands_pending = false;
+    uint8_t emergencies = emergency_count;
+    sei();
+
+    if (t.invalid) {
+        printf("Invalid message format (%u)\n", t.invalid);
+    }
+    if (t.frames == 0) return;
+
+    frames_folded += t.frames;
+    printf("Applying %u frame(s)\n", t.frames);
+
+    apply_led(MOVEMENT_LED, &t.led[MOVEMENT_LED], "Movement");
+    apply_led(DOOR_LED, &t.led[DOOR_LED], "Door");
+
+    if (t.sound_op == SOUND_PLAY) {
+        // Stop then play is not just play: the scheduler would suspend
+        // the stopped sound and resume it after the new one
+        if (t.sound_stop && isMelodyPlaying()) {
+            printf("Stopping sound\n");
+            stopMelody();
+            commands_applied++;
+        }
+        printf("Playing sound ID: %u\n", t.sound_id);
+        playMelody(t.sound_id);
+        commands_applied++;
+        // An emergency stop that came in meanwhile wins
+        if (emergency_count != emergencies) {
+            stopAllSounds();
+        }
+    } else if (t.sound_op == SOUND_STOP) {
+        if (isMelodyPlaying()) {
+            printf("Stopping sound\n");
+            stopMelody();
+            commands_applied++;
+        } else {
+            commands_dropped++;
+        }
     }
 }
 
@@ -90,12 +240,19 @@ FILE uart_input = FDEV_SETUP_STREAM(NULL, USART_getchar, _FDEV_SETUP_READ);
 /* Main Loop */
 int main(void)
 {
-    /* Initialize LEDs */
-    led_init(&MOVEMENT_LED_DDR, &MOVEMENT_LED_PORT, MOVEMENT_LED_PIN);
-    led_init(&DOOR_LED_DDR, &DOOR_LED_PORT, DOOR_LED_PIN);
-        
     /* Initialize Coms */
     USART_init(9600);  // For debugging
+    SYSTICK_init();    // Time base for the sleep statistics and LED patterns
+    IDLE_init();       // Power down unused peripherals
+
+    /* Initialize LEDs */
+    led_channel_init(MOVEMENT_LED, &MOVEMENT_LED_DDR, &MOVEMENT_LED_PORT, MOVEMENT_LED_PIN);
+    led_channel_init(DOOR_LED, &DOOR_LED_DDR, &DOOR_LED_PORT, DOOR_LED_PIN);
+    led_channel_pwm(MOVEMENT_LED, MOVEMENT_LED_PWM);
+    led_channel_pwm(DOOR_LED, DOOR_LED_PWM);
+
+    /* Uploaded sounds */
+    UPLOAD_init();
     
     // redirect the stdin and stdout to UART functions
     stdout = &uart_output;
@@ -116,11 +273,45 @@ int main(void)
     printf("Waiting for messages via interrupt...\n");
     printf("Current TWI status: 0x%02X\n", TWI_get_status());
     
+    uint32_t last_report = IDLE_millis();  // keeps counting in power-save
+
     while (1) {
 
-        // empty loop, we are handling messages in the interrupt
-        
-        // Small delay to prevent UART flooding
-        _delay_ms(50);
+        // A committed upload first, so a play frame sent right after the
+        // commit finds the new sound
+        UPLOAD_process();
+        if (commands_pending) {
+            apply_commands();
+        }
+        if (emergency_count != emergencies_reported) {
+            emergencies_reported++;
+            printf("EMERGENCY STOP\n");
+        }
+
+        // Messages are folded in the interrupt, so sleep until the next one.
+        // Without a melody or LED pattern no timer is needed and power-save
+        // can be used; a TWI address match wakes the CPU again. Interrupts
+        // stay off from the check until the sleep, so a frame arriving in
+        // between wakes the CPU at once instead of waiting in the queue.
+        cli();
+        if (!commands_pending && !UPLOAD_pending() && emergency_count == emergencies_reported) {
+            IDLE_sleep(!isMelodyPlaying() && !led_busy() && !UPLOAD_busy());
+        }
+        sei();
+
+        if (IDLE_millis() - last_report >= SLEEP_REPORT_MS) {
+            IDLE_report();
+            printf("Frames: %u, commands applied: %u, dropped as superseded: %u\n",
+                   frames_folded, commands_applied, commands_dropped);
+            frames_folded = 0;
+            commands_applied = 0;
+            commands_dropped = 0;
+
+            BuzzerStats buzzer;
+            getBuzzerStats(&buzzer);
+            printf("Buzzer interrupts: sequencer %lu, tone %lu\n",
+                   buzzer.sequencer_interrupts, buzzer.tone_interrupts);
+            last_report = IDLE_millis();
+        }
     }
 }
\ No newline at end of file
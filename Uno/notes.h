@@ -103,6 +103,28 @@
 // Rest note definition (silence/pause)
 #define REST 0
 
+// Every note above as a semitone index (PITCH_B0 = 0 ... PITCH_DS8), for the
+// compressed melody format; the list keeps the frequency order
+#define PITCH_LIST(X) \
+    X(B0) X(C1) X(CS1) X(D1) X(DS1) X(E1) X(F1) X(FS1) \
+    X(G1) X(GS1) X(A1) X(AS1) X(B1) X(C2) X(CS2) X(D2) \
+    X(DS2) X(E2) X(F2) X(FS2) X(G2) X(GS2) X(A2) X(AS2) \
+    X(B2) X(C3) X(CS3) X(D3) X(DS3) X(E3) X(F3) X(FS3) \
+    X(G3) X(GS3) X(A3) X(AS3) X(B3) X(C4) X(CS4) X(D4) \
+    X(DS4) X(E4) X(F4) X(FS4) X(G4) X(GS4) X(A4) X(AS4) \
+    X(B4) X(C5) X(CS5) X(D5) X(DS5) X(E5) X(F5) X(FS5) \
+    X(G5) X(GS5) X(A5) X(AS5) X(B5) X(C6) X(CS6) X(D6) \
+    X(DS6) X(E6) X(F6) X(FS6) X(G6) X(GS6) X(A6) X(AS6) \
+    X(B6) X(C7) X(CS7) X(D7) X(DS7) X(E7) X(F7) X(FS7) \
+    X(G7) X(GS7) X(A7) X(AS7) X(B7) X(C8) X(CS8) X(D8) \
+    X(DS8)
+
+#define PITCH_ENUM(name) PITCH_##name,
+typedef enum {
+    PITCH_LIST(PITCH_ENUM)
+    PITCH_COUNT
+} Pitch;
+
 // Note duration enum - assumes 4/4 time signature
 typedef enum {
     // Basic note durations
@@ -3,16 +3,21 @@
 
 #include <avr/io.h>
 
-#define MOVEMENT_LED_PORT PORTB
-#define MOVEMENT_LED_DDR  DDRB
-#define MOVEMENT_LED_PIN  PB0
+// The LEDs sit on the Timer0 compare outputs for PWM dimming
+#define MOVEMENT_LED_PORT PORTD
+#define MOVEMENT_LED_DDR  DDRD
+#define MOVEMENT_LED_PIN  PD6   // OC0A
+#define MOVEMENT_LED_PWM  LED_PWM_OC0A
 
-#define DOOR_LED_PORT PORTB
-#define DOOR_LED_DDR  DDRB
-#define DOOR_LED_PIN  PB2
+#define DOOR_LED_PORT PORTD
+#define DOOR_LED_DDR  DDRD
+#define DOOR_LED_PIN  PD5       // OC0B
+#define DOOR_LED_PWM  LED_PWM_OC0B
 
+#define BUZZER_PORT PORTB
 #define BUZZER_DDR  DDRB
-#define BUZZER_PIN  PB1
+#define BUZZER_PIN  PB1     // OC1A, lead voice
+#define BUZZER2_PIN PB2     // OC1B, harmony voice
 
 #endif // PINS_H
 
@@ -0,0 +1,239 @@
+/*
+ * upload.c
+ *
+ * An upload is staged in RAM from the TWI interrupt. Once committed, the
+ * main loop checks its CRC and copies it to the play cache of its slot,
+ * where it can be played at once, then marks the slot for write-back.
+ *
+ * The write-back programs one EEPROM byte per system tick, and only once
+ * the previous one is done, so neither the main loop nor the player waits
+ * for the EEPROM. Unchanged bytes are skipped, and the valid marker is
+ * only cleared before the first byte that actually differs and set again
+ * last: uploading the same sound again writes nothing, and an interrupted
+ * write-back leaves the slot empty rather than corrupt.
+ */
+
+#include "upload.h"
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <util/crc16.h>
+#include <stdio.h>
+#include <string.h>
+
+// Common includes
+#include "systick.h"
+
+#define UPLOAD_MAGIC     0x5A
+#define UPLOAD_MIN_SIZE  (UPLOAD_HEADER_SIZE + 2 + UPLOAD_CRC_SIZE)  // base pitch and one byte
+#define UPLOAD_COMPARES_PER_TICK 16     // unchanged bytes skipped per tick
+
+typedef struct {
+    uint8_t valid;                      // UPLOAD_MAGIC while the slot is complete
+    uint8_t length;                     // image bytes
+    uint8_t image[UPLOAD_SLOT_SIZE];
+} UploadSlot;
+
+static UploadSlot EEMEM ee_slots[UPLOAD_SLOTS];
+
+// Play cache, the image of every slot
+static uint8_t cache[UPLOAD_SLOTS][UPLOAD_SLOT_SIZE];
+static uint8_t cache_length[UPLOAD_SLOTS];  // 0: empty slot
+static uint16_t cache_ticks[UPLOAD_SLOTS];  // SOUND_TEMPO() of the image, divided here
+
+// Staging, written from the TWI interrupt until the commit
+typedef enum {
+    STAGING_IDLE,
+    STAGING_RECEIVING,
+    STAGING_COMMITTED                   // waits for UPLOAD_process()
+} StagingState;
+
+static uint8_t staging[UPLOAD_SLOT_SIZE];
+static volatile uint8_t staging_state = STAGING_IDLE;
+static bool staging_ok;
+static uint8_t staging_slot;
+static uint8_t staging_length;
+static uint8_t staging_received;
+
+// Write-back state, advanced from the system tick
+static volatile uint8_t dirty = 0;      // slots to write, one bit each
+static volatile bool writing = false;
+static uint8_t write_slot;
+static uint8_t write_index;             // 0: length, then the image bytes
+static bool write_invalidated;
+
+// true if the image has a melody, a tempo and the right CRC
+static bool image_valid(const uint8_t *image, uint8_t length) {
+    if (length < UPLOAD_MIN_SIZE || length > UPLOAD_SLOT_SIZE || image[0] == 0) {
+        return false;
+    }
+
+    uint16_t crc = UPLOAD_CRC_INIT;
+    uint8_t end = length - UPLOAD_CRC_SIZE;
+    for (uint8_t i = 0; i < end; i++) {
+        crc = _crc_ccitt_update(crc, image[i]);
+    }
+    return crc == (((uint16_t)image[end] << 8) | image[end + 1]);
+}
+
+// Runs on every system tick: programs at most one EEPROM byte
+static void upload_tick(void) {
+    if (!writing) {
+        if (dirty == 0) return;
+
+        write_slot = 0;
+        while (!(dirty & (1 << write_slot))) write_slot++;
+        dirty &= ~(1 << write_slot);
+        write_index = 0;
+        write_invalidated = false;
+        writing = true;
+    }
+
+    if (!eeprom_is_ready()) {
+        return; // previous byte still being programmed
+    }
+
+    if (dirty & (1 << write_slot)) {
+        // Uploaded again meanwhile: start over with the new image
+        dirty &= ~(1 << write_slot);
+        write_index = 0;
+    }
+
+    UploadSlot *ee = &ee_slots[write_slot];
+    uint8_t length = cache_length[write_slot];
+
+    // Reads are quick, skip a few unchanged bytes per tick
+    for (uint8_t n = 0; n < UPLOAD_COMPARES_PER_TICK; n++, write_index++) {
+        if (write_index > length) break;
+
+        uint8_t *addr = write_index == 0 ? &ee->length : &ee->image[write_index - 1];
+        uint8_t value = write_index == 0 ? length : cache[write_slot][write_index - 1];
+        if (eeprom_read_byte(addr) == value) continue;
+
+        if (!write_invalidated) {
+            eeprom_write_byte(&ee->valid, 0);
+            write_invalidated = true;
+        } else {
+            eeprom_write_byte(addr, value);
+            write_index++;
+        }
+        return;
+    }
+    if (write_index <= length) {
+        return; // more to compare on the next tick
+    }
+
+    if (eeprom_read_byte(&ee->valid) != UPLOAD_MAGIC) {
+        eeprom_write_byte(&ee->valid, UPLOAD_MAGIC);
+    }
+    writing = false;
+}
+
+void UPLOAD_init(void) {
+    for (uint8_t slot = 0; slot < UPLOAD_SLOTS; slot++) {
+        cache_length[slot] = 0;
+        if (eeprom_read_byte(&ee_slots[slot].valid) != UPLOAD_MAGIC) continue;
+
+        uint8_t length = eeprom_read_byte(&ee_slots[slot].length);
+        if (length > UPLOAD_SLOT_SIZE) continue;
+
+        eeprom_read_block(cache[slot], ee_slots[slot].image, length);
+        if (image_valid(cache[slot], length)) {
+            cache_ticks[slot] = SOUND_TEMPO(cache[slot][0]);
+            cache_length[slot] = length;
+        }
+    }
+
+    SYSTICK_add_callback(upload_tick);
+}
+
+void UPLOAD_handle(uint32_t message) {
+    uint8_t data;
+    uint16_t value;
+    uint8_t step = read_message_upload(message, &data, &value);
+
+    if (staging_state == STAGING_COMMITTED) {
+        return; // the last upload is not checked yet
+    }
+
+    switch (step) {
+        case UPLOAD_BEGIN:
+            staging_state = STAGING_RECEIVING;
+            staging_ok = data < UPLOAD_SLOTS && value >= UPLOAD_MIN_SIZE && value <= UPLOAD_SLOT_SIZE;
+            staging_slot = data;
+            staging_length = value;
+            staging_received = 0;
+            break;
+        case UPLOAD_DATA:
+            if (staging_state != STAGING_RECEIVING) break;
+            if (value == staging_received && staging_received < staging_length) {
+                staging[staging_received++] = data;
+            } else if (value + 1 != staging_received || staging[value] != data) {
+                staging_ok = false; // lost or out of order; a repeated frame is ignored
+            }
+            break;
+        case UPLOAD_COMMIT:
+            if (staging_state != STAGING_RECEIVING) break;
+            if (data != staging_slot || staging_received != staging_length) {
+                staging_ok = false;
+            }
+            staging_state = STAGING_COMMITTED;
+            break;
+        default:
+            staging_state = STAGING_IDLE;
+            break;
+    }
+}
+
+bool UPLOAD_pending(void) {
+    return staging_state == STAGING_COMMITTED;
+}
+
+void UPLOAD_process(void) {
+    if (staging_state != STAGING_COMMITTED) return;
+
+    uint8_t slot = staging_slot;
+    if (!staging_ok || !image_valid(staging, staging_length)) {
+        printf("Upload to slot %u failed\n", slot);
+        staging_state = STAGING_IDLE;
+        return;
+    }
+
+    // Not in UPLOAD_get_sound(), which may run in the sequencer interrupt
+    uint16_t ticks = SOUND_TEMPO(staging[0]);
+
+    // The player may be reading the old image from an interrupt
+    uint8_t sreg = SREG;
+    cli();
+    forgetSound(UPLOAD_SOUND_ID(slot));
+    memcpy(cache[slot], staging, staging_length);
+    cache_length[slot] = staging_length;
+    cache_ticks[slot] = ticks;
+    dirty |= (1 << slot);
+    SREG = sreg;
+
+    printf("Sound %u uploaded, %u bytes\n", UPLOAD_SOUND_ID(slot), staging_length);
+    staging_state = STAGING_IDLE;
+}
+
+bool UPLOAD_busy(void) {
+    return writing || dirty != 0;
+}
+
+bool UPLOAD_get_sound(uint8_t sound_id, SoundDescriptor *sound) {
+    uint8_t slot = sound_id - UPLOAD_FIRST_SOUND;
+    if (sound_id < UPLOAD_FIRST_SOUND || slot >= UPLOAD_SLOTS || cache_length[slot] == 0) {
+        return false;
+    }
+
+    const uint8_t *image = cache[slot];
+    sound->data = image + UPLOAD_HEADER_SIZE;
+    sound->length = cache_length[slot] - UPLOAD_HEADER_SIZE - UPLOAD_CRC_SIZE;
+    sound->harmony = NULL;
+    sound->harmony_length = 0;
+    sound->whole_ticks = cache_ticks[slot];
+    sound->flags = SOUND_RAM | ((image[1] & UPLOAD_REPEAT) ? SOUND_REPEAT : 0);
+    sound->priority = image[2] <= SOUND_PRIORITY_EMERGENCY ? image[2] : SOUND_PRIORITY_BACKGROUND;
+    return true;
+}
@@ -0,0 +1,65 @@
+/*
+ * upload.h
+ *
+ * Sounds uploaded over TWI with SOUND_UPLOAD frames (see message.h), kept
+ * in EEPROM slots and played from a RAM copy.
+ */
+
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "Buzzer.h"
+#include "message.h"
+
+#define UPLOAD_SLOT_SIZE   UPLOAD_MAX_SIZE
+
+/**
+ * @brief Load the valid slots from EEPROM and start the write-back
+ *
+ * A slot whose EEPROM copy is incomplete or fails its CRC stays empty.
+ * Requires SYSTICK_init().
+ */
+void UPLOAD_init(void);
+
+/**
+ * @brief Stage one SOUND_UPLOAD frame
+ * @param message Valid message with SOUND_UPLOAD set
+ *
+ * Called from the TWI interrupt. A frame out of order fails the upload.
+ */
+void UPLOAD_handle(uint32_t message);
+
+/**
+ * @brief Check whether a committed upload waits for UPLOAD_process()
+ */
+bool UPLOAD_pending(void);
+
+/**
+ * @brief Check a committed upload and make it playable
+ *
+ * Call from the main loop. The staged image is checked against its CRC and
+ * copied to the play cache of its slot; the EEPROM copy is written in the
+ * background. A sound playing from the slot is stopped first.
+ */
+void UPLOAD_process(void);
+
+/**
+ * @brief Check whether a slot is still being written to EEPROM
+ *
+ * The write-back runs from the system tick, which needs the CPU in idle
+ * sleep rather than power-save.
+ */
+bool UPLOAD_busy(void);
+
+/**
+ * @brief Describe the sound of an uploaded slot
+ * @param sound_id UPLOAD_SOUND_ID() of a slot
+ * @param sound Filled in with the melody in the play cache (SOUND_RAM)
+ * @return false if the ID is not a slot or the slot is empty
+ */
+bool UPLOAD_get_sound(uint8_t sound_id, SoundDescriptor *sound);
+
+#endif